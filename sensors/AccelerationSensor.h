@@ -24,28 +24,33 @@
 
 
 #include "nusensors.h"
-#include "SensorBase.h"
-#include "InputEventReader.h"
+#include "InputSensor.h"
 
 /*****************************************************************************/
 
-struct input_event;
-
-class AccelerationSensor : public SensorBase {
-    int mEnabled;
-    int mOrientationEnabled;
-    InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvent;
+struct AccelerationTraits {
+    static const char* const devName;
+    static const char* const inputName;
+    static const char* const name;
+    static const int handle = ID_A;
+    static const int sensorType = SENSOR_TYPE_ACCELEROMETER;
+    static const bool hasStatus = true;
+    static const int eventType = EV_REL;
+    // the accelerometer also sends valid ABS events for userspace
+    // using EVIOCGABS
+    static const int ignoredType = EV_ABS;
+    static const int numAxes = 3;
+    static const int codes[numAxes];
+    static const float scales[numAxes];
+    static const unsigned long getEnable;
+    static const unsigned long setEnable;
+    static const unsigned long setDelay;
+};
 
+class AccelerationSensor : public InputSensor<AccelerationTraits> {
 public:
             AccelerationSensor();
     virtual ~AccelerationSensor();
-
-    virtual int readEvents(sensors_event_t* data, int count);
-    virtual int setDelay(int32_t handle, int64_t ns);
-    virtual int enable(int32_t handle, int enabled);
-    int enableOrientation(int enabled);
-    void processEvent(int code, int value);
 };
 
 /*****************************************************************************/
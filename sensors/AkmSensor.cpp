@@ -16,6 +16,7 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <math.h>
 #include <poll.h>
 #include <unistd.h>
@@ -27,6 +28,7 @@
 #include <cutils/log.h>
 
 #include "AkmSensor.h"
+#include "SensorStats.h"
 
 /*****************************************************************************/
 
@@ -34,9 +36,15 @@ AkmSensor::AkmSensor()
     : SensorBase(AKM_DEVICE_NAME, "compass"),
       mEnabled(0),
       mPendingMask(0),
-      mInputReader(32)
+      mInputReader(32),
+      mHasRawField(false),
+      mDropping(false),
+      mResuming(false),
+      mFrameTime(0)
 {
     memset(mPendingEvents, 0, sizeof(mPendingEvents));
+    memset(mRawField, 0, sizeof(mRawField));
+    mCalibration.load(MAG_CALIBRATION_FILE);
 
     mPendingEvents[Accelerometer].version = sizeof(sensors_event_t);
     mPendingEvents[Accelerometer].sensor = ID_A;
@@ -46,15 +54,7 @@ AkmSensor::AkmSensor()
     mPendingEvents[MagneticField].version = sizeof(sensors_event_t);
     mPendingEvents[MagneticField].sensor = ID_M;
     mPendingEvents[MagneticField].type = SENSOR_TYPE_MAGNETIC_FIELD;
-    mPendingEvents[MagneticField].magnetic.status = SENSOR_STATUS_ACCURACY_HIGH;
-
-    mPendingEvents[Orientation  ].version = sizeof(sensors_event_t);
-    mPendingEvents[Orientation  ].sensor = ID_O;
-    mPendingEvents[Orientation  ].type = SENSOR_TYPE_ORIENTATION;
-    mPendingEvents[Orientation  ].orientation.status = SENSOR_STATUS_ACCURACY_HIGH;
-
-    for (int i=0 ; i<numSensors ; i++)
-        mDelays[i] = 200000000; // 200 ms by default
+    mPendingEvents[MagneticField].magnetic.status = mCalibration.getAccuracy();
 
     // read the actual value of all sensors if they're enabled already
     struct input_absinfo absinfo;
@@ -74,7 +74,10 @@ AkmSensor::AkmSensor()
     }
     if (!ioctl(dev_fd, ECS_IOCTL_APP_GET_MFLAG, &flags)) {
         if (flags)  {
-            mEnabled |= 1<<Orientation;
+            // orientation is computed by the HAL now, stop akmd from
+            // doing it behind our back
+            flags = 0;
+            ioctl(dev_fd, ECS_IOCTL_APP_SET_MFLAG, &flags);
         }
     }
     if (!mEnabled) {
@@ -83,6 +86,7 @@ AkmSensor::AkmSensor()
 }
 
 AkmSensor::~AkmSensor() {
+    mCalibration.commit();
 }
 
 int AkmSensor::enable(int32_t handle, int en)
@@ -91,7 +95,6 @@ int AkmSensor::enable(int32_t handle, int en)
     switch (handle) {
         case ID_A: what = Accelerometer; break;
         case ID_M: what = MagneticField; break;
-        case ID_O: what = Orientation;   break;
     }
 
     if (uint32_t(what) >= numSensors)
@@ -108,7 +111,6 @@ int AkmSensor::enable(int32_t handle, int en)
         switch (what) {
             case Accelerometer: cmd = ECS_IOCTL_APP_SET_AFLAG;  break;
             case MagneticField: cmd = ECS_IOCTL_APP_SET_MVFLAG; break;
-            case Orientation:   cmd = ECS_IOCTL_APP_SET_MFLAG;  break;
         }
         short flags = newState;
         err = ioctl(dev_fd, cmd, &flags);
@@ -117,7 +119,12 @@ int AkmSensor::enable(int32_t handle, int en)
         if (!err) {
             mEnabled &= ~(1<<what);
             mEnabled |= (uint32_t(flags)<<what);
-            update_delay();
+            updateDelay();
+            // the calibration is written out here rather than while
+            // decoding events
+            if (what == MagneticField && !newState) {
+                mCalibration.commit();
+            }
         }
         if (!mEnabled) {
             close_device();
@@ -126,85 +133,105 @@ int AkmSensor::enable(int32_t handle, int en)
     return err;
 }
 
-int AkmSensor::setDelay(int32_t handle, int64_t ns)
+bool AkmSensor::isEnabled() const {
+    return mEnabled != 0;
+}
+
+int AkmSensor::programDelay(int64_t ns)
 {
+    // both sensors and the EV_SYN
+    mInputReader.setFrameRate(ns, 7);
 #ifdef ECS_IOCTL_APP_SET_DELAY
-    int what = -1;
-    switch (handle) {
-        case ID_A: what = Accelerometer; break;
-        case ID_M: what = MagneticField; break;
-        case ID_O: what = Orientation;   break;
+    // akmd takes a short in ms, don't let long periods wrap around
+    int64_t ms = ns / 1000000;
+    short delay = ms > SHRT_MAX ? SHRT_MAX : short(ms);
+    if (ioctl(dev_fd, ECS_IOCTL_APP_SET_DELAY, &delay)) {
+        return -errno;
     }
-
-    if (uint32_t(what) >= numSensors)
-        return -EINVAL;
-
-    if (ns < 0)
-        return -EINVAL;
-
-    mDelays[what] = ns;
-    return update_delay();
+    return 0;
 #else
     return -1;
 #endif
 }
 
-int AkmSensor::update_delay()
-{
-    if (mEnabled) {
-        uint64_t wanted = -1LLU;
-        for (int i=0 ; i<numSensors ; i++) {
-            if (mEnabled & (1<<i)) {
-                uint64_t ns = mDelays[i];
-                wanted = wanted < ns ? wanted : ns;
-            }
-        }
-        short delay = int64_t(wanted) / 1000000;
-        if (ioctl(dev_fd, ECS_IOCTL_APP_SET_DELAY, &delay)) {
-            return -errno;
-        }
-    }
-    return 0;
-}
-
 int AkmSensor::readEvents(sensors_event_t* data, int count)
 {
     if (count < 1)
         return -EINVAL;
 
     ssize_t n = mInputReader.fill(data_fd);
-    if (n < 0)
+    if (n < 0) {
+        SensorStats::fillError(ID_M);
         return n;
+    }
+    updateClockOffset();
 
     int numEventReceived = 0;
     input_event const* event;
+    ssize_t numEvents;
 
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if (type == EV_REL) {
-            processEvent(event->code, event->value);
-            mInputReader.next();
-        } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            for (int j=0 ; count && mPendingMask && j<numSensors ; j++) {
-                if (mPendingMask & (1<<j)) {
-                    mPendingMask &= ~(1<<j);
-                    mPendingEvents[j].timestamp = time;
-                    if (mEnabled & (1<<j)) {
-                        *data++ = mPendingEvents[j];
-                        count--;
-                        numEventReceived++;
+    while (count && (numEvents = mInputReader.readEvents(&event))) {
+        ssize_t i;
+        for (i=0 ; count && i<numEvents ; i++, event++) {
+            int type = event->type;
+            if (type == EV_REL) {
+                if (!mDropping) {
+                    processEvent(event->code, event->value);
+                }
+            } else if (type == EV_SYN && event->code == SYN_DROPPED) {
+                // the frame in progress lost some of its events, the axes
+                // are relative so there is nothing to read back, the next
+                // frame brings them
+                mPendingMask = 0;
+                mHasRawField = false;
+                mDropping = true;
+                SensorStats::inputOverrun(ID_M);
+            } else if (type == EV_SYN && mDropping) {
+                mDropping = false;
+            } else if (type == EV_SYN) {
+                // a frame finished on a second call was already stamped
+                // and calibrated, the filter must only see it once
+                if (!mResuming) {
+                    const int64_t time = eventTimestamp(event->time);
+                    mFrameTime = mTimestampFilter.filter(time);
+                    for (int j=0 ; j<numSensors ; j++) {
+                        SensorStats::setKernelTime(&mPendingEvents[j], time);
+                    }
+                    if (mHasRawField) {
+                        // calibrate on every sample, used or not
+                        mHasRawField = false;
+                        sensors_event_t& ev(mPendingEvents[MagneticField]);
+                        mCalibration.addSample(mRawField);
+                        mCalibration.apply(mRawField, ev.magnetic.v);
+                        ev.magnetic.status = mCalibration.getAccuracy();
                     }
                 }
+                mResuming = false;
+                for (int j=0 ; count && mPendingMask && j<numSensors ; j++) {
+                    if (mPendingMask & (1<<j)) {
+                        mPendingMask &= ~(1<<j);
+                        mPendingEvents[j].timestamp = mFrameTime;
+                        SensorStats::eventRead(mPendingEvents[j].sensor);
+                        if (mEnabled & (1<<j)) {
+                            *data++ = mPendingEvents[j];
+                            count--;
+                            numEventReceived++;
+                        } else {
+                            SensorStats::eventDropped(mPendingEvents[j].sensor);
+                        }
+                    }
+                }
+                if (mPendingMask) {
+                    // out of room, finish this frame on the next call
+                    mResuming = true;
+                    break;
+                }
+            } else {
+                LOGE("AkmSensor: unknown event (type=%d, code=%d)",
+                        type, event->code);
             }
-            if (!mPendingMask) {
-                mInputReader.next();
-            }
-        } else {
-            LOGE("AkmSensor: unknown event (type=%d, code=%d)",
-                    type, event->code);
-            mInputReader.next();
         }
+        mInputReader.consume(i);
     }
 
     return numEventReceived;
@@ -228,33 +255,22 @@ void AkmSensor::processEvent(int code, int value)
 
         case EVENT_TYPE_MAGV_X:
             mPendingMask |= 1<<MagneticField;
-            mPendingEvents[MagneticField].magnetic.x = value * CONVERT_M_X;
+            mHasRawField = true;
+            mRawField[0] = value * CONVERT_M_X;
             break;
         case EVENT_TYPE_MAGV_Y:
             mPendingMask |= 1<<MagneticField;
-            mPendingEvents[MagneticField].magnetic.y = value * CONVERT_M_Y;
+            mHasRawField = true;
+            mRawField[1] = value * CONVERT_M_Y;
             break;
         case EVENT_TYPE_MAGV_Z:
             mPendingMask |= 1<<MagneticField;
-            mPendingEvents[MagneticField].magnetic.z = value * CONVERT_M_Z;
+            mHasRawField = true;
+            mRawField[2] = value * CONVERT_M_Z;
             break;
 
-        case EVENT_TYPE_YAW:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.azimuth = value * CONVERT_O_Y;
-            break;
-        case EVENT_TYPE_PITCH:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.pitch = value * CONVERT_O_P;
-            break;
-        case EVENT_TYPE_ROLL:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.roll = value * CONVERT_O_R;
-            break;
         case EVENT_TYPE_ORIENT_STATUS:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.status =
-                    uint8_t(value & SENSOR_STATE_MASK);
+            // akmd's own accuracy, ours replaces it
             break;
     }
 }
@@ -26,6 +26,7 @@
 #include "nusensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "MagCalibration.h"
 
 /*****************************************************************************/
 
@@ -39,22 +40,28 @@ public:
     enum {
         Accelerometer   = 0,
         MagneticField   = 1,
-        Orientation     = 2,
         numSensors
     };
 
-    virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled);
+    virtual bool isEnabled() const;
     virtual int readEvents(sensors_event_t* data, int count);
     void processEvent(int code, int value);
 
+protected:
+    virtual int programDelay(int64_t ns);
+
 private:
-    int update_delay();
     uint32_t mEnabled;
     uint32_t mPendingMask;
     InputEventCircularReader mInputReader;
     sensors_event_t mPendingEvents[numSensors];
-    uint64_t mDelays[numSensors];
+    float mRawField[3];     // uT, before calibration
+    bool mHasRawField;      // not calibrated yet
+    bool mDropping;         // up to the SYN_REPORT after a SYN_DROPPED
+    bool mResuming;         // the frame's SYN_REPORT was left in the reader
+    int64_t mFrameTime;     // of the frame being returned
+    MagCalibration mCalibration;
 };
 
 /*****************************************************************************/
@@ -16,22 +16,38 @@
 
 LOCAL_PATH:= $(call my-dir)
 
-# HAL module implemenation stored in
-# hw/<COPYPIX_HARDWARE_MODULE_ID>.<ro.board.platform>.so
-include $(CLEAR_VARS)
-
-LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\"
-
-LOCAL_SRC_FILES := 						\
+sensors_src_files := 						\
 				sensors.c 			\
 				nusensors.cpp 			\
 				InputEventReader.cpp		\
+				InputDeviceIndex.cpp		\
 				SensorBase.cpp			\
 				AccelerationSensor.cpp		\
 				LightSensor.cpp			\
 				AkmSensor.cpp			\
 				PressureSensor.cpp		\
-				GyroSensor.cpp
+				GyroSensor.cpp			\
+				EventBatcher.cpp		\
+				SensorStats.cpp			\
+				DriverThread.cpp		\
+				SensorFusion.cpp		\
+				TimestampFilter.cpp		\
+				ControlChannel.cpp		\
+				DirectChannel.cpp		\
+				MagCalibration.cpp		\
+				GyroBias.cpp		\
+				InputTrace.cpp		\
+				TraceWriter.cpp		\
+				TraceReader.cpp		\
+				SensorConfig.cpp
+
+# HAL module implemenation stored in
+# hw/<COPYPIX_HARDWARE_MODULE_ID>.<ro.board.platform>.so
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\"
+
+LOCAL_SRC_FILES := $(sensors_src_files)
 
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
@@ -42,3 +58,25 @@ LOCAL_SHARED_LIBRARIES := liblog libcutils
 LOCAL_MODULE := sensors.stingray
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Host benchmark feeding input_event streams to the HAL through pipes,
+# see bench/SensorsBench.cpp
+include $(CLEAR_VARS)
+
+# the driver ioctl headers only ship with bionic's kernel headers, look
+# there after the host ones
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -idirafter bionic/libc/kernel/common
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+LOCAL_SRC_FILES := $(sensors_src_files)		\
+				bench/SensorsBench.cpp		\
+				bench/ioctl_stub.c
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := sensors_bench
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "ControlChannel.h"
+
+/*****************************************************************************/
+
+ControlChannel::ControlChannel()
+    : mHead(0),
+      mTail(0)
+{
+    mFd = eventfd(0, 0);
+    LOGE_IF(mFd<0, "error creating control eventfd (%s)", strerror(errno));
+    if (mFd >= 0) {
+        fcntl(mFd, F_SETFL, O_NONBLOCK);
+    }
+
+    // each slot carries the position it can be posted at next, the
+    // consumer moves it a lap ahead once it has read the command
+    for (int i=0 ; i<queueSize ; i++) {
+        mSlots[i].seq = i;
+    }
+}
+
+ControlChannel::~ControlChannel()
+{
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+int ControlChannel::getFd() const
+{
+    return mFd;
+}
+
+int ControlChannel::post(int what, int handle, int64_t arg)
+{
+    Slot* slot;
+    for (;;) {
+        const int32_t pos = android_atomic_acquire_load(&mHead);
+        slot = &mSlots[pos & (queueSize - 1)];
+        const int32_t seq = android_atomic_acquire_load(&slot->seq);
+        if (seq == pos) {
+            // the slot is free, claim it
+            if (!android_atomic_cmpxchg(pos, pos + 1, &mHead)) {
+                slot->cmd.what = what;
+                slot->cmd.handle = handle;
+                slot->cmd.arg = arg;
+                android_atomic_release_store(pos + 1, &slot->seq);
+                break;
+            }
+        } else if (seq - pos < 0) {
+            // the consumer hasn't read this slot a lap ago
+            return -EAGAIN;
+        }
+        // else another thread claimed it first, try the next one
+    }
+    wake();
+    return 0;
+}
+
+void ControlChannel::wake()
+{
+    const uint64_t one = 1;
+    int result = write(mFd, &one, sizeof(one));
+    LOGE_IF(result<0 && errno != EAGAIN,
+            "error signaling the control eventfd (%s)", strerror(errno));
+}
+
+void ControlChannel::drain()
+{
+    uint64_t count;
+    int result = read(mFd, &count, sizeof(count));
+    LOGE_IF(result<0 && errno != EAGAIN,
+            "error reading the control eventfd (%s)", strerror(errno));
+}
+
+bool ControlChannel::hasCommands() const
+{
+    const Slot* slot = &mSlots[mTail & (queueSize - 1)];
+    return android_atomic_acquire_load(&slot->seq) == mTail + 1;
+}
+
+bool ControlChannel::next(Command* cmd)
+{
+    Slot* slot = &mSlots[mTail & (queueSize - 1)];
+    const int32_t seq = android_atomic_acquire_load(&slot->seq);
+    if (seq != mTail + 1)
+        return false;
+    *cmd = slot->cmd;
+    android_atomic_release_store(mTail + queueSize, &slot->seq);
+    mTail++;
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CONTROL_CHANNEL_H
+#define ANDROID_CONTROL_CHANNEL_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Commands from the HAL entry points to the poll thread. They go through
+ * a bounded lock-free queue that any thread can post to and only the poll
+ * thread reads, and an eventfd in the poll set wakes the poll thread up.
+ * The eventfd is also what the driver threads signal when they have
+ * queued events.
+ */
+class ControlChannel
+{
+public:
+    enum {
+        CMD_FLUSH       = 1,    // handle
+        CMD_CLOSE       = 2,
+        CMD_DIRECT_ADD  = 3,    // channel, DirectChannel*
+        CMD_DIRECT_REMOVE = 4,  // channel
+        CMD_SEA_LEVEL   = 5,    // pressure in 1/1000 hPa
+    };
+
+    struct Command {
+        int32_t what;
+        int32_t handle;
+        int64_t arg;
+    };
+
+    enum { queueSize = 64 };    // must be a power of two
+
+            ControlChannel();
+            ~ControlChannel();
+
+    int getFd() const;
+
+    // any thread, -EAGAIN if the queue is full
+    int post(int what, int handle = 0, int64_t arg = 0);
+    // any thread, wakes the poll thread without a command
+    void wake();
+
+    // poll thread only
+    bool hasCommands() const;
+    void drain();
+    bool next(Command* cmd);
+
+private:
+    struct Slot {
+        volatile int32_t seq;
+        Command cmd;
+    };
+
+    int mFd;
+    Slot mSlots[queueSize];
+    volatile int32_t mHead;     // next slot to post to
+    int32_t mTail;              // next slot to read
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_CONTROL_CHANNEL_H
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "DirectChannel.h"
+
+/*****************************************************************************/
+
+DirectChannel::DirectChannel(size_t size)
+    : mFd(-1),
+      mBase(MAP_FAILED),
+      mSize(size),
+      mHeader(0),
+      mRecords(0),
+      mCapacity(0),
+      mHead(0)
+{
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+        mPeriods[i] = -1;
+        mNextEvent[i] = 0;
+    }
+
+    if (size < sizeof(direct_report_header_t) + sizeof(direct_report_record_t))
+        return;
+
+    mFd = ashmem_create_region("sensors-direct-channel", size);
+    if (mFd < 0) {
+        LOGE("couldn't create direct channel (%s)", strerror(errno));
+        return;
+    }
+    mBase = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (mBase == MAP_FAILED) {
+        LOGE("couldn't map direct channel (%s)", strerror(errno));
+        return;
+    }
+    // the mapping above keeps its rights, the ones made from the fd we
+    // hand out can only read
+    if (ashmem_set_prot_region(mFd, PROT_READ) < 0) {
+        LOGE("couldn't make direct channel read-only (%s)", strerror(errno));
+        munmap(mBase, size);
+        mBase = MAP_FAILED;
+        return;
+    }
+
+    mHeader = (direct_report_header_t*)mBase;
+    mRecords = (direct_report_record_t*)(mHeader + 1);
+    mCapacity = (size - sizeof(direct_report_header_t)) /
+            sizeof(direct_report_record_t);
+
+    memset(mBase, 0, sizeof(direct_report_header_t));
+    mHeader->magic = DIRECT_REPORT_MAGIC;
+    mHeader->version = DIRECT_REPORT_VERSION;
+    mHeader->capacity = mCapacity;
+    mHeader->recordSize = sizeof(direct_report_record_t);
+    for (uint32_t i=0 ; i<mCapacity ; i++) {
+        mRecords[i].seq = 0;
+    }
+}
+
+DirectChannel::~DirectChannel()
+{
+    if (mBase != MAP_FAILED) {
+        munmap(mBase, mSize);
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+int DirectChannel::initCheck() const
+{
+    if (mFd < 0)
+        return -EINVAL;
+    return mBase == MAP_FAILED ? -ENOMEM : 0;
+}
+
+int DirectChannel::getFd() const
+{
+    return mFd;
+}
+
+void DirectChannel::setRate(int handle, int64_t period)
+{
+    if (uint32_t(handle) < NUM_SENSOR_HANDLES) {
+        mPeriods[handle] = period < 0 ? -1 : period;
+        mNextEvent[handle] = 0;
+    }
+}
+
+int64_t DirectChannel::getRate(int handle) const
+{
+    return uint32_t(handle) < NUM_SENSOR_HANDLES ? mPeriods[handle] : -1;
+}
+
+void DirectChannel::report(sensors_event_t const& event)
+{
+    const int handle = event.sensor;
+    if (uint32_t(handle) >= NUM_SENSOR_HANDLES || mPeriods[handle] < 0)
+        return;
+    if (!isDueOnGrid(event.timestamp, mPeriods[handle], &mNextEvent[handle]))
+        return;
+
+    // readers seeing an odd seq, or one that doesn't match the position
+    // they expect, know the record is being rewritten
+    direct_report_record_t* record = &mRecords[mHead % mCapacity];
+    const int32_t seq = int32_t(mHead * 2);
+    android_atomic_release_store(seq + 1, &record->seq);
+    android_memory_barrier();
+    record->event = event;
+    android_atomic_release_store(seq + 2, &record->seq);
+    mHead++;
+    android_atomic_release_store(int32_t(mHead), &mHeader->head);
+}
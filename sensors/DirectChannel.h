@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DIRECT_CHANNEL_H
+#define ANDROID_DIRECT_CHANNEL_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+#include "SensorConfig.h"
+
+/*****************************************************************************/
+
+/*
+ * The writer side of a direct report channel, an ashmem region laid out
+ * as described with direct_report_header_t. Only the poll thread uses it.
+ */
+class DirectChannel
+{
+public:
+            DirectChannel(size_t size);
+            ~DirectChannel();
+
+    // 0 once the region is mapped, and read-only to the clients
+    int initCheck() const;
+    int getFd() const;
+
+    // negative period stops reporting the handle
+    void setRate(int handle, int64_t period);
+    int64_t getRate(int handle) const;
+
+    // adds the event to the ring if its sensor is reported here and due
+    void report(sensors_event_t const& event);
+
+private:
+    int mFd;
+    void* mBase;
+    size_t mSize;
+    direct_report_header_t* mHeader;
+    direct_report_record_t* mRecords;
+    uint32_t mCapacity;
+    uint32_t mHead;
+    int64_t mPeriods[NUM_SENSOR_HANDLES];
+    int64_t mNextEvent[NUM_SENSOR_HANDLES];
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_DIRECT_CHANNEL_H
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "DriverThread.h"
+
+/*****************************************************************************/
+
+
+DriverThread::DriverThread(SensorBase* sensor, int wakeFd,
+        volatile int32_t* consumerSleeping)
+    : mSensor(sensor),
+      mWakeFd(wakeFd),
+      mConsumerSleeping(consumerSleeping),
+      mRunning(false),
+      mSuspending(false),
+      mSuspended(false),
+      mExited(false),
+      mHead(0),
+      mTail(0)
+{
+    mControlFds[0] = mControlFds[1] = -1;
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+}
+
+DriverThread::~DriverThread()
+{
+    stop();
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+}
+
+int DriverThread::start()
+{
+    if (mSensor->getFd() < 0)
+        return -ENODEV;
+    if (pipe(mControlFds) < 0)
+        return -errno;
+    int err = pthread_create(&mThread, NULL, threadLoop, this);
+    if (err) {
+        LOGE("couldn't start driver thread (%s)", strerror(err));
+        close(mControlFds[0]);
+        close(mControlFds[1]);
+        mControlFds[0] = mControlFds[1] = -1;
+        return -err;
+    }
+    mRunning = true;
+    return 0;
+}
+
+void DriverThread::stop()
+{
+    if (mRunning) {
+        const char msg = 'S';
+        write(mControlFds[1], &msg, 1);
+        pthread_join(mThread, NULL);
+        mRunning = false;
+    }
+    if (mControlFds[0] >= 0) {
+        close(mControlFds[0]);
+        close(mControlFds[1]);
+        mControlFds[0] = mControlFds[1] = -1;
+    }
+}
+
+void DriverThread::suspend()
+{
+    if (!mRunning)
+        return;
+    pthread_mutex_lock(&mLock);
+    mSuspending = true;
+    const char msg = 'P';
+    write(mControlFds[1], &msg, 1);
+    while (!mSuspended && !mExited) {
+        pthread_cond_wait(&mCond, &mLock);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void DriverThread::resume()
+{
+    if (!mRunning)
+        return;
+    pthread_mutex_lock(&mLock);
+    mSuspending = false;
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+bool DriverThread::handleControl()
+{
+    // true when asked to stop
+    char msg;
+    if (read(mControlFds[0], &msg, 1) != 1 || msg == 'S')
+        return true;
+    pthread_mutex_lock(&mLock);
+    mSuspended = true;
+    pthread_cond_broadcast(&mCond);
+    while (mSuspending) {
+        pthread_cond_wait(&mCond, &mLock);
+    }
+    mSuspended = false;
+    pthread_mutex_unlock(&mLock);
+    return false;
+}
+
+sensors_event_t const* DriverThread::peek() const
+{
+    const int32_t head = mHead;
+    if (head == android_atomic_acquire_load(&mTail))
+        return NULL;
+    return &mQueue[head & (queueSize - 1)];
+}
+
+void DriverThread::pop()
+{
+    android_atomic_release_store(mHead + 1, &mHead);
+}
+
+void DriverThread::notify()
+{
+    // the consumer sets the flag before it checks the queues one last
+    // time and goes to sleep, both sides use full barriers
+    if (android_atomic_or(0, mConsumerSleeping)) {
+        const uint64_t one = 1;
+        write(mWakeFd, &one, sizeof(one));
+    }
+}
+
+void* DriverThread::threadLoop(void* arg)
+{
+    DriverThread* const thread = static_cast<DriverThread*>(arg);
+    thread->readLoop();
+    // nobody waits on a thread that's gone
+    pthread_mutex_lock(&thread->mLock);
+    thread->mExited = true;
+    pthread_cond_broadcast(&thread->mCond);
+    pthread_mutex_unlock(&thread->mLock);
+    return NULL;
+}
+
+void DriverThread::readLoop()
+{
+    struct pollfd fds[2];
+    fds[0].fd = mSensor->getFd();
+    fds[0].events = POLLIN;
+    fds[1].fd = mControlFds[0];
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        fds[0].revents = fds[1].revents = 0;
+        int n = poll(fds, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("driver thread poll() failed (%s)", strerror(errno));
+            break;
+        }
+        if (fds[1].revents) {
+            if (handleControl())
+                break;
+            if (!fds[0].revents)
+                continue;
+        }
+        if ((fds[0].revents & (POLLERR | POLLNVAL)) ||
+                fds[0].revents == POLLHUP) {
+            LOGE("driver thread lost its input device");
+            break;
+        }
+
+        // read until the driver has nothing left, including what's still
+        // in its reader after a short read
+        for (;;) {
+            const int32_t tail = mTail;
+            const int32_t used = tail - android_atomic_acquire_load(&mHead);
+            if (used == queueSize) {
+                // the poll thread is behind, give it a moment
+                notify();
+                if (poll(&fds[1], 1, 1) > 0 && handleControl())
+                    return;
+                continue;
+            }
+            const int index = tail & (queueSize - 1);
+            int room = queueSize - used;
+            if (room > queueSize - index)
+                room = queueSize - index;
+
+            int nb = mSensor->readEvents(&mQueue[index], room);
+            if (nb > 0) {
+                android_atomic_release_store(tail + nb, &mTail);
+                notify();
+            }
+            if ((nb < room) && !mSensor->hasPendingEvents())
+                break;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRIVER_THREAD_H
+#define ANDROID_DRIVER_THREAD_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+/*
+ * Reads one driver on its own thread, so a slow read() on one device
+ * doesn't hold back the others. Decoded events go into a single-producer
+ * single-consumer queue that the poll thread drains; the producer only
+ * writes to the wake fd when the consumer has said it is about to sleep.
+ *
+ * The driver itself is only touched by this thread while it runs; the
+ * poll thread suspends it around enable() and setDelay().
+ */
+class DriverThread
+{
+public:
+    enum { queueSize = 256 };   // must be a power of two
+
+            DriverThread(SensorBase* sensor, int wakeFd,
+                    volatile int32_t* consumerSleeping);
+            ~DriverThread();
+
+    int start();
+    void stop();
+
+    // parks the thread between two reads of the driver, until resume()
+    void suspend();
+    void resume();
+
+    // consumer side, returns the oldest queued event or NULL
+    sensors_event_t const* peek() const;
+    void pop();
+
+private:
+    SensorBase* const mSensor;
+    const int mWakeFd;
+    volatile int32_t* const mConsumerSleeping;
+    int mControlFds[2];
+    pthread_t mThread;
+    bool mRunning;
+
+    // suspend() handshake, under mLock
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+    bool mSuspending;
+    bool mSuspended;
+    bool mExited;
+
+    // mHead is only written by the consumer, mTail by the producer
+    volatile int32_t mHead;
+    volatile int32_t mTail;
+    sensors_event_t mQueue[queueSize];
+
+    static void* threadLoop(void* arg);
+    void readLoop();
+    bool handleControl();
+    void notify();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_DRIVER_THREAD_H
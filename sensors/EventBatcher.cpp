@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/log.h>
+
+#include "EventBatcher.h"
+#include "SensorStats.h"
+
+/*****************************************************************************/
+
+EventBatcher::EventBatcher()
+    : mFlushing(false)
+{
+    memset(mRings, 0, sizeof(mRings));
+}
+
+EventBatcher::~EventBatcher()
+{
+    for (int i=0 ; i<numHandles ; i++) {
+        delete [] mRings[i].events;
+    }
+}
+
+int64_t EventBatcher::now()
+{
+    struct timespec t;
+    t.tv_sec = t.tv_nsec = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+int EventBatcher::setLatency(int handle, int64_t ns)
+{
+    if (uint32_t(handle) >= numHandles || ns < 0)
+        return -EINVAL;
+
+    Ring* ring = &mRings[handle];
+    if (ns && !ring->events) {
+        ring->events = new sensors_event_t[ringSize];
+    }
+    if (!ns && ring->size) {
+        // deliver what was held back under the old latency right away
+        ring->deadline = 0;
+    }
+    ring->latency = ns;
+    return 0;
+}
+
+void EventBatcher::clear(int handle)
+{
+    if (uint32_t(handle) < numHandles) {
+        mRings[handle].head = 0;
+        mRings[handle].size = 0;
+    }
+}
+
+void EventBatcher::push(Ring* ring, sensors_event_t const& event)
+{
+    if (!ring->size) {
+        ring->deadline = now() + ring->latency;
+    }
+    if (ring->size == ringSize) {
+        // the flush didn't keep up, drop the oldest event
+        LOGW("batch ring of sensor %d overflowed", event.sensor);
+        SensorStats::eventDropped(event.sensor);
+        ring->head = (ring->head + 1) % ringSize;
+        ring->size--;
+    }
+    ring->events[(ring->head + ring->size) % ringSize] = event;
+    ring->size++;
+}
+
+int EventBatcher::filter(sensors_event_t* data, int count)
+{
+    int kept = 0;
+    for (int i=0 ; i<count ; i++) {
+        const int handle = data[i].sensor;
+        Ring* ring = uint32_t(handle) < numHandles ? &mRings[handle] : 0;
+        if (ring && ring->latency) {
+            push(ring, data[i]);
+        } else {
+            if (kept != i) {
+                data[kept] = data[i];
+            }
+            kept++;
+        }
+    }
+    return kept;
+}
+
+int EventBatcher::space() const
+{
+    int space = ringSize;
+    for (int i=0 ; i<numHandles ; i++) {
+        Ring const* ring = &mRings[i];
+        if (ring->latency && int(ringSize - ring->size) < space) {
+            space = ringSize - ring->size;
+        }
+    }
+    return space;
+}
+
+bool EventBatcher::isFlushDue(int64_t now) const
+{
+    if (mFlushing)
+        return true;
+    for (int i=0 ; i<numHandles ; i++) {
+        Ring const* ring = &mRings[i];
+        if (ring->size && (ring->size == ringSize || ring->deadline <= now))
+            return true;
+    }
+    return false;
+}
+
+int EventBatcher::flushTimeout(int64_t now) const
+{
+    int64_t earliest = -1;
+    for (int i=0 ; i<numHandles ; i++) {
+        Ring const* ring = &mRings[i];
+        if (ring->size && (earliest < 0 || ring->deadline < earliest)) {
+            earliest = ring->deadline;
+        }
+    }
+    if (earliest < 0)
+        return -1;
+    if (earliest <= now)
+        return 0;
+    // round up so we don't wake up just before the deadline
+    return int((earliest - now + 999999) / 1000000);
+}
+
+int EventBatcher::flush(sensors_event_t* data, int count)
+{
+    mFlushing = true;
+    int numEvents = 0;
+    while (numEvents < count) {
+        Ring* oldest = 0;
+        for (int i=0 ; i<numHandles ; i++) {
+            Ring* ring = &mRings[i];
+            if (ring->size && (!oldest ||
+                    ring->events[ring->head].timestamp <
+                    oldest->events[oldest->head].timestamp)) {
+                oldest = ring;
+            }
+        }
+        if (!oldest) {
+            mFlushing = false;
+            break;
+        }
+        data[numEvents++] = oldest->events[oldest->head];
+        oldest->head = (oldest->head + 1) % ringSize;
+        oldest->size--;
+    }
+    return numEvents;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_EVENT_BATCHER_H
+#define ANDROID_EVENT_BATCHER_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+/*
+ * Holds back the events of sensors that have a max report latency. Each
+ * batched handle has its own ring; once the oldest event of any ring has
+ * waited for its latency, or a ring is full, all the rings are flushed
+ * together, merged in timestamp order.
+ */
+class EventBatcher
+{
+public:
+    enum {
+        numHandles  = NUM_SENSOR_HANDLES,
+        ringSize    = 128,
+    };
+
+            EventBatcher();
+            ~EventBatcher();
+
+    int setLatency(int handle, int64_t ns);
+    void clear(int handle);
+
+    // moves the events of batched sensors out of data, returns how many
+    // are left
+    int filter(sensors_event_t* data, int count);
+    // how many events of one handle filter() can take without dropping
+    // any, 0 when a ring is full and has to be flushed first
+    int space() const;
+
+    // true when the rings have to be flushed
+    bool isFlushDue(int64_t now) const;
+    // time in ms until the rings have to be flushed, -1 if never
+    int flushTimeout(int64_t now) const;
+    // writes the flushed events in timestamp order
+    int flush(sensors_event_t* data, int count);
+
+    static int64_t now();
+
+private:
+    struct Ring {
+        sensors_event_t* events;
+        int64_t latency;
+        int64_t deadline;
+        size_t head;
+        size_t size;
+    };
+
+    Ring mRings[numHandles];
+    bool mFlushing;
+
+    void push(Ring* ring, sensors_event_t const& event);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_EVENT_BATCHER_H
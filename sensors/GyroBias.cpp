@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "GyroBias.h"
+
+/*****************************************************************************/
+
+// weight of each sample in the running means and variances
+#define ALPHA               (1.0f/32)
+// the rates vary less than this while still, in (rad/s)^2: a few times
+// the noise of the L3G4200D at its fastest rate
+#define STILL_VARIANCE      (4e-4f)
+// and so does the acceleration, in (m/s^2)^2
+#define ACCEL_VARIANCE      (1e-2f)
+// how long the device has to be still before the mean is trusted
+#define STILL_TIME          (500000000LL)
+// the offset then follows the mean with this weight per sample
+#define BIAS_ALPHA          (1.0f/256)
+// it drifts with temperature, but not by more than this in rad/s between
+// two still periods; a mean further away is a steady rotation
+#define MAX_DRIFT           (0.05f)
+// unless it stays still for this many periods of STILL_TIME in a row
+#define MAX_FAR_WINDOWS     (10)
+// an accelerometer sample older than this doesn't count
+#define ACCEL_TIMEOUT       (200000000LL)
+// a gap this long in the gyroscope samples restarts the statistics
+#define MAX_GAP             (1000000000LL)
+
+/*****************************************************************************/
+
+GyroBias::GyroBias()
+{
+    reset();
+}
+
+void GyroBias::reset()
+{
+    memset(mBias, 0, sizeof(mBias));
+    mBiasVar = 0;
+    mHasBias = false;
+    mFarSince = 0;
+    mFarWindows = 0;
+    memset(mMean, 0, sizeof(mMean));
+    memset(mVar, 0, sizeof(mVar));
+    memset(mAccelMean, 0, sizeof(mAccelMean));
+    memset(mAccelVar, 0, sizeof(mAccelVar));
+    mLastTime = 0;
+    mStillSince = 0;
+    mLastAccelTime = 0;
+}
+
+static inline void update(const float* x, float* mean, float* var)
+{
+    for (int i=0 ; i<3 ; i++) {
+        const float d = x[i] - mean[i];
+        mean[i] += ALPHA * d;
+        var[i] = (1 - ALPHA) * (var[i] + ALPHA * d * d);
+    }
+}
+
+void GyroBias::addAccel(sensors_event_t const& event)
+{
+    if (!mLastAccelTime || event.timestamp - mLastAccelTime > MAX_GAP) {
+        memcpy(mAccelMean, event.acceleration.v, sizeof(mAccelMean));
+        memset(mAccelVar, 0, sizeof(mAccelVar));
+    }
+    update(event.acceleration.v, mAccelMean, mAccelVar);
+    mLastAccelTime = event.timestamp;
+}
+
+bool GyroBias::isAccelStill(int64_t now) const
+{
+    if (!mLastAccelTime || now - mLastAccelTime > ACCEL_TIMEOUT)
+        return true;
+    return mAccelVar[0] < ACCEL_VARIANCE &&
+            mAccelVar[1] < ACCEL_VARIANCE &&
+            mAccelVar[2] < ACCEL_VARIANCE;
+}
+
+bool GyroBias::isNearBias() const
+{
+    if (!mHasBias)
+        return true;
+    for (int i=0 ; i<3 ; i++) {
+        const float d = mMean[i] - mBias[i];
+        if (d > MAX_DRIFT || d < -MAX_DRIFT)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Counts the periods the rates stay still away from the offset, and tells
+ * when the mean should replace it: after MAX_FAR_WINDOWS of them in a row,
+ * or after one if the rates are half as noisy as when it was learned.
+ */
+bool GyroBias::isFarStill(bool still, int64_t now)
+{
+    if (!still || isNearBias()) {
+        mFarSince = 0;
+        if (!still)
+            mFarWindows = 0;
+        return false;
+    }
+    if (!mFarSince) {
+        mFarSince = now;
+        return false;
+    }
+    if (now - mFarSince < STILL_TIME)
+        return false;
+    mFarSince = now;
+    mFarWindows++;
+    const float var = mVar[0] + mVar[1] + mVar[2];
+    return mFarWindows >= MAX_FAR_WINDOWS || 2 * var < mBiasVar;
+}
+
+bool GyroBias::isStationary() const
+{
+    return mStillSince && mLastTime - mStillSince >= STILL_TIME;
+}
+
+void GyroBias::correct(sensors_event_t* event)
+{
+    const int64_t now = event->timestamp;
+    float* const v = event->gyro.v;
+    if (!mLastTime || now - mLastTime > MAX_GAP) {
+        // start from the sample, with a variance that takes a while to
+        // settle
+        memcpy(mMean, v, sizeof(mMean));
+        for (int i=0 ; i<3 ; i++)
+            mVar[i] = STILL_VARIANCE;
+        mStillSince = 0;
+        mFarSince = 0;
+        mFarWindows = 0;
+    }
+    update(v, mMean, mVar);
+    mLastTime = now;
+
+    const bool quiet = mVar[0] < STILL_VARIANCE &&
+            mVar[1] < STILL_VARIANCE &&
+            mVar[2] < STILL_VARIANCE &&
+            isAccelStill(now);
+    if (isFarStill(quiet, now)) {
+        // the old offset was wrong: start over from this mean, it has
+        // been still for a whole period already
+        memcpy(mBias, mMean, sizeof(mBias));
+        mBiasVar = mVar[0] + mVar[1] + mVar[2];
+        mFarSince = 0;
+        mFarWindows = 0;
+        mStillSince = now - STILL_TIME;
+    }
+    const bool still = quiet && isNearBias();
+    if (!still) {
+        mStillSince = 0;
+    } else if (!mStillSince) {
+        mStillSince = now;
+    }
+
+    if (isStationary()) {
+        for (int i=0 ; i<3 ; i++) {
+            mBias[i] = mHasBias ?
+                    mBias[i] + BIAS_ALPHA * (mMean[i] - mBias[i]) : mMean[i];
+        }
+        mBiasVar = mVar[0] + mVar[1] + mVar[2];
+        mHasBias = true;
+    }
+
+    for (int i=0 ; i<3 ; i++)
+        v[i] -= mBias[i];
+}
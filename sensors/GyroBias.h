@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GYRO_BIAS_H
+#define ANDROID_GYRO_BIAS_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+/*
+ * Zero rate offset of the gyroscope. Exponentially weighted running means
+ * and variances of the rates tell when the device is still, and then the
+ * mean is the offset. A steady rotation looks still to the gyroscope: while
+ * the accelerometer is running its variance has to be low too, which
+ * catches the rotations that tilt the device, and once there is an offset
+ * a mean far from it isn't taken for one, unless it stays put for long
+ * enough or is quieter than the one the offset was learned from: the
+ * offset may have been learned during a slow rotation, or jumped after a
+ * temperature change. Everything is O(1) per sample.
+ */
+class GyroBias
+{
+public:
+            GyroBias();
+
+    // forgets everything, the offset too
+    void reset();
+
+    // takes an accelerometer event, to confirm the device is still
+    void addAccel(sensors_event_t const& event);
+
+    // takes a gyroscope event and subtracts the offset from it
+    void correct(sensors_event_t* event);
+
+    bool isStationary() const;
+
+private:
+    float mMean[3];
+    float mVar[3];
+    float mBias[3];
+    float mBiasVar;         // variance of the rates the offset came from
+    bool mHasBias;
+    int64_t mLastTime;
+    int64_t mStillSince;    // 0 while moving
+    int64_t mFarSince;      // 0 unless still away from the offset
+    int mFarWindows;        // consecutive still periods away from it
+
+    float mAccelMean[3];
+    float mAccelVar[3];
+    int64_t mLastAccelTime;
+
+    bool isAccelStill(int64_t now) const;
+    bool isNearBias() const;
+    bool isFarStill(bool still, int64_t now);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_GYRO_BIAS_H
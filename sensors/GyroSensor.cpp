@@ -15,127 +15,39 @@
  * limitations under the License.
  */
 
-#include <fcntl.h>
 #include <errno.h>
-#include <math.h>
-#include <poll.h>
-#include <unistd.h>
-#include <dirent.h>
-#include <sys/select.h>
 
 #include <linux/l3g4200d.h>
 
-#include <cutils/log.h>
-
 #include "GyroSensor.h"
 
 /*****************************************************************************/
 
-GyroSensor::GyroSensor()
-    : SensorBase(GYROSCOPE_DEVICE_NAME, "gyroscope"),
-      mEnabled(0),
-      mInputReader(32)
-{
-    mPendingEvent.version = sizeof(sensors_event_t);
-    mPendingEvent.sensor = ID_G;
-    mPendingEvent.type = SENSOR_TYPE_GYROSCOPE;
-    mPendingEvent.gyro.status = SENSOR_STATUS_ACCURACY_HIGH;
-    memset(mPendingEvent.data, 0x00, sizeof(mPendingEvent.data));
-
-    open_device();
-
-    int flags = 0;
-    if (!ioctl(dev_fd, L3G4200D_IOCTL_GET_ENABLE, &flags)) {
-        if (flags)  {
-            mEnabled = 1;
-        }
-    }
-
-    if (!mEnabled) {
-        close_device();
-    }
-}
-
-GyroSensor::~GyroSensor() {
-}
-
-int GyroSensor::enable(int32_t, int en)
-{
-    int flags = en ? 1 : 0;
-    int err = 0;
-    if (flags != mEnabled) {
-        if (flags) {
-            open_device();
-        }
-        err = ioctl(dev_fd, L3G4200D_IOCTL_SET_ENABLE, &flags);
-        err = err<0 ? -errno : 0;
-        LOGE_IF(err, "L3G4200D_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
-        if (!err) {
-            mEnabled = flags;
-        }
-        if (!flags) {
-            close_device();
-        }
-    }
-    return err;
-}
+const char* const GyroTraits::devName = GYROSCOPE_DEVICE_NAME;
+const char* const GyroTraits::inputName = "gyroscope";
+const char* const GyroTraits::name = "GyroSensor";
 
-int GyroSensor::setDelay(int32_t handle, int64_t ns)
-{
-    if (ns < 0)
-        return -EINVAL;
+const int GyroTraits::codes[] = {
+        EVENT_TYPE_GYRO_P,
+        EVENT_TYPE_GYRO_R,
+        EVENT_TYPE_GYRO_Y
+};
+const float GyroTraits::scales[] = {
+        CONVERT_G_P,
+        CONVERT_G_R,
+        CONVERT_G_Y
+};
 
-    int delay = ns / 1000000;
-    if (ioctl(dev_fd, L3G4200D_IOCTL_SET_DELAY, &delay)) {
-        return -errno;
-    }
-    return 0;
-}
+const unsigned long GyroTraits::getEnable = L3G4200D_IOCTL_GET_ENABLE;
+const unsigned long GyroTraits::setEnable = L3G4200D_IOCTL_SET_ENABLE;
+const unsigned long GyroTraits::setDelay  = L3G4200D_IOCTL_SET_DELAY;
 
-int GyroSensor::readEvents(sensors_event_t* data, int count)
-{
-    if (count < 1)
-        return -EINVAL;
+template class InputSensor<GyroTraits>;
 
-    ssize_t n = mInputReader.fill(data_fd);
-    if (n < 0)
-        return n;
-    int numEventReceived = 0;
-    input_event const* event;
-
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if (type == EV_REL) {
-            processEvent(event->code, event->value);
-        } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            mPendingEvent.timestamp = time;
-            if (mEnabled) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
-            }
-        } else {
-            LOGE("GyroSensor: unknown event (type=%d, code=%d)",
-                    type, event->code);
-        }
-        mInputReader.next();
-    }
+/*****************************************************************************/
 
-    return numEventReceived;
+GyroSensor::GyroSensor() {
 }
 
-void GyroSensor::processEvent(int code, int value)
-{
-    switch (code) {
-        case EVENT_TYPE_GYRO_P:
-            mPendingEvent.gyro.x = value * CONVERT_G_P;
-            break;
-        case EVENT_TYPE_GYRO_R:
-            mPendingEvent.gyro.y = value * CONVERT_G_R;
-            break;
-        case EVENT_TYPE_GYRO_Y:
-            mPendingEvent.gyro.z = value * CONVERT_G_Y;
-            break;
-    }
+GyroSensor::~GyroSensor() {
 }
@@ -25,29 +25,33 @@
 
 
 #include "nusensors.h"
-#include "SensorBase.h"
-#include "InputEventReader.h"
+#include "InputSensor.h"
 
 /*****************************************************************************/
 
-struct input_event;
-
-class GyroSensor : public SensorBase {
-    int mEnabled;
-    InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvent;
+struct GyroTraits {
+    static const char* const devName;
+    static const char* const inputName;
+    static const char* const name;
+    static const int handle = ID_G;
+    static const int sensorType = SENSOR_TYPE_GYROSCOPE;
+    static const bool hasStatus = true;
+    static const int eventType = EV_REL;
+    static const int ignoredType = -1;
+    static const int numAxes = 3;
+    static const int codes[numAxes];
+    static const float scales[numAxes];
+    static const unsigned long getEnable;
+    static const unsigned long setEnable;
+    static const unsigned long setDelay;
+};
 
+class GyroSensor : public InputSensor<GyroTraits> {
 public:
             GyroSensor();
     virtual ~GyroSensor();
-
-    virtual int enable(int32_t handle, int enabled);
-    virtual int readEvents(sensors_event_t* data, int count);
-    virtual int setDelay(int32_t handle, int64_t ns);
-
-    void processEvent(int code, int value);
 };
 
 /*****************************************************************************/
 
-#endif  // ANDROID_ACCELERATION_SENSOR_H
+#endif  // ANDROID_GYRO_SENSOR_H
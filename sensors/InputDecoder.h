@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INPUT_DECODER_H
+#define ANDROID_INPUT_DECODER_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*****************************************************************************/
+
+/*
+ * Frames of an input device decoded a batch at a time, one array per axis
+ * and one for the timestamps, so that the conversion to SI units runs four
+ * frames per instruction.
+ */
+template <int NUM_AXES>
+struct InputDecoder {
+    enum {
+        batchSize = 64,         // frames, a multiple of 4
+    };
+
+    int32_t raw[NUM_AXES][batchSize] __attribute__((aligned(16)));
+    float value[NUM_AXES][batchSize] __attribute__((aligned(16)));
+    int64_t time[batchSize];
+
+    // value[axis][i] = raw[axis][i] * scale, for the first count frames
+    void convert(int axis, float scale, size_t count) {
+        int32_t const* in = raw[axis];
+        float* out = value[axis];
+        size_t i = 0;
+#if defined(__ARM_NEON__)
+        const float32x4_t s = vdupq_n_f32(scale);
+        for ( ; i+4 <= count ; i += 4) {
+            vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(in + i)), s));
+        }
+#elif defined(__SSE2__)
+        // the drivers are allocated with new, which doesn't honour the
+        // alignment of these arrays on 32-bit hosts
+        const __m128 s = _mm_set1_ps(scale);
+        for ( ; i+4 <= count ; i += 4) {
+            __m128i v = _mm_loadu_si128((__m128i const*)(in + i));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), s));
+        }
+#endif
+        for ( ; i<count ; i++) {
+            out[i] = in[i] * scale;
+        }
+    }
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_INPUT_DECODER_H
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <linux/input.h>
+
+#include <cutils/log.h>
+
+#include "InputDeviceIndex.h"
+
+/*****************************************************************************/
+
+pthread_mutex_t InputDeviceIndex::sLock = PTHREAD_MUTEX_INITIALIZER;
+InputDeviceIndex::Device InputDeviceIndex::sDevices[maxDevices];
+size_t InputDeviceIndex::sNumDevices = 0;
+bool InputDeviceIndex::sScanned = false;
+const char* InputDeviceIndex::sSysfsDir = "/sys/class/input";
+const char* InputDeviceIndex::sDevDir = "/dev/input";
+
+int InputDeviceIndex::openDevice(const char* inputName)
+{
+    pthread_mutex_lock(&sLock);
+    int fd = -1;
+    int err = 0;
+    if (!sScanned) {
+        err = scanLocked();
+    }
+    if (!err) {
+        fd = openLocked(inputName);
+        if (fd < 0) {
+            // the device may have been plugged in since the last scan
+            err = scanLocked();
+            if (!err) {
+                fd = openLocked(inputName);
+            }
+        }
+    }
+    pthread_mutex_unlock(&sLock);
+
+    if (err) {
+        fd = openByScan(inputName);
+    }
+    LOGE_IF(fd<0, "couldn't find '%s' input device", inputName);
+    return fd;
+}
+
+void InputDeviceIndex::refresh()
+{
+    pthread_mutex_lock(&sLock);
+    sNumDevices = 0;
+    sScanned = false;
+    pthread_mutex_unlock(&sLock);
+}
+
+void InputDeviceIndex::setDirs(const char* sysfsDir, const char* devDir)
+{
+    pthread_mutex_lock(&sLock);
+    sSysfsDir = sysfsDir;
+    sDevDir = devDir;
+    sNumDevices = 0;
+    sScanned = false;
+    pthread_mutex_unlock(&sLock);
+}
+
+int InputDeviceIndex::scanLocked()
+{
+    DIR* dir = opendir(sSysfsDir);
+    if (dir == NULL)
+        return -errno;
+
+    // the known nodes are read again too, their number may have been
+    // reused by another device
+    sNumDevices = 0;
+    struct dirent* de;
+    while ((de = readdir(dir))) {
+        if (strncmp(de->d_name, "event", 5))
+            continue;
+        if (sNumDevices == maxDevices) {
+            LOGW("too many input devices, ignoring %s", de->d_name);
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s/device/name",
+                sSysfsDir, de->d_name);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        Device* device = &sDevices[sNumDevices];
+        ssize_t n = read(fd, device->name, sizeof(device->name) - 1);
+        close(fd);
+        if (n <= 0)
+            continue;
+        if (device->name[n-1] == '\n')
+            n--;
+        device->name[n] = '\0';
+        device->number = atoi(de->d_name + 5);
+        sNumDevices++;
+    }
+    closedir(dir);
+    sScanned = true;
+    return 0;
+}
+
+int InputDeviceIndex::openLocked(const char* inputName)
+{
+    for (size_t i=0 ; i<sNumDevices ; i++) {
+        if (strcmp(sDevices[i].name, inputName))
+            continue;
+
+        char devname[PATH_MAX];
+        snprintf(devname, sizeof(devname), "%s/event%d",
+                sDevDir, sDevices[i].number);
+        int fd = open(devname, O_RDONLY);
+        if (fd < 0)
+            return -1;
+
+        // the node may have been reused by another device since the scan
+        char name[80];
+        if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), &name) < 1) {
+            name[0] = '\0';
+        }
+        if (!strcmp(name, inputName))
+            return fd;
+        close(fd);
+        removeLocked(i);
+        return -1;
+    }
+    return -1;
+}
+
+void InputDeviceIndex::removeLocked(size_t index)
+{
+    sNumDevices--;
+    for (size_t i=index ; i<sNumDevices ; i++) {
+        sDevices[i] = sDevices[i+1];
+    }
+}
+
+int InputDeviceIndex::openByScan(const char* inputName)
+{
+    int fd = -1;
+    char devname[PATH_MAX];
+    char *filename;
+    DIR *dir;
+    struct dirent *de;
+    dir = opendir(sDevDir);
+    if(dir == NULL)
+        return -1;
+    strcpy(devname, sDevDir);
+    filename = devname + strlen(devname);
+    *filename++ = '/';
+    while((de = readdir(dir))) {
+        if(de->d_name[0] == '.' &&
+                (de->d_name[1] == '\0' ||
+                        (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+            continue;
+        strcpy(filename, de->d_name);
+        fd = open(devname, O_RDONLY);
+        if (fd>=0) {
+            char name[80];
+            if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), &name) < 1) {
+                name[0] = '\0';
+            }
+            if (!strcmp(name, inputName)) {
+                break;
+            } else {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    closedir(dir);
+    return fd;
+}
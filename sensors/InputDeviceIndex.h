@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INPUT_DEVICE_INDEX_H
+#define ANDROID_INPUT_DEVICE_INDEX_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Maps input device names to their /dev/input/eventN nodes. The names are
+ * read from /sys/class/input, so looking up a device doesn't open every
+ * node. A scan reads all of them again: an event number given back by a
+ * device that went away can be taken by the next one plugged in. When
+ * sysfs isn't available, the /dev/input nodes are scanned instead.
+ */
+class InputDeviceIndex
+{
+    enum { maxDevices = 32 };
+
+    struct Device {
+        int number;
+        char name[80];
+    };
+
+    static pthread_mutex_t sLock;
+    static Device sDevices[maxDevices];
+    static size_t sNumDevices;
+    static bool sScanned;
+    static const char* sSysfsDir;
+    static const char* sDevDir;
+
+    static int scanLocked();
+    static int openLocked(const char* inputName);
+    static void removeLocked(size_t index);
+    static int openByScan(const char* inputName);
+
+public:
+    // returns an fd on the event node of the named device, or -1; a
+    // name that isn't known rescans for devices added since
+    static int openDevice(const char* inputName);
+
+    // forgets the devices, the next lookup scans again; called when the
+    // HAL is opened, devices may have come and gone since the last time
+    static void refresh();
+
+    // lets a test harness stand in for /sys/class/input and /dev/input
+    static void setDirs(const char* sysfsDir, const char* devDir);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_INPUT_DEVICE_INDEX_H
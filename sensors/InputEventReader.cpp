@@ -20,37 +20,146 @@
 #include <poll.h>
 
 #include <sys/cdefs.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 
 #include <linux/input.h>
 
+#include <cutils/ashmem.h>
 #include <cutils/log.h>
 
+#include "nusensors.h"
 #include "InputEventReader.h"
+#include "InputTrace.h"
 
 /*****************************************************************************/
 
 struct input_event;
 
 InputEventCircularReader::InputEventCircularReader(size_t numEvents)
-    : mBuffer(new input_event[numEvents * 2]),
-      mBufferEnd(mBuffer + numEvents),
-      mHead(mBuffer),
-      mCurr(mBuffer),
-      mFreeSpace(numEvents)
+    : mBuffer(0),
+      mBufferEnd(0),
+      mHead(0),
+      mCurr(0),
+      mFreeSpace(0),
+      mMapSize(0),
+      mWanted(0)
 {
+    if (!mapRing(numEvents)) {
+        mBuffer = new input_event[numEvents * 2];
+        mBufferEnd = mBuffer + numEvents;
+    }
+    mHead = mBuffer;
+    mCurr = mBuffer;
+    mFreeSpace = mBufferEnd - mBuffer;
 }
 
 InputEventCircularReader::~InputEventCircularReader()
 {
-    delete [] mBuffer;
+    if (mMapSize) {
+        munmap(mBuffer, mMapSize * 2);
+    } else {
+        delete [] mBuffer;
+    }
+}
+
+bool InputEventCircularReader::mapRing(size_t numEvents)
+{
+    // the region must be a whole number of pages and of events
+    const size_t pageSize = getpagesize();
+    size_t size = (numEvents * sizeof(input_event) + pageSize - 1) & ~(pageSize - 1);
+    while (size % sizeof(input_event)) {
+        size += pageSize;
+    }
+
+    int fd = ashmem_create_region("sensors-input-ring", size);
+    if (fd < 0) {
+        LOGW("couldn't create input ring (%s)", strerror(errno));
+        return false;
+    }
+
+    // reserve room for both views, then map the region over each half
+    uint8_t* base = (uint8_t*)mmap(NULL, size * 2, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool mapped = base != MAP_FAILED;
+    if (mapped) {
+        mapped = mmap(base, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                 mmap(base + size, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+        if (!mapped) {
+            munmap(base, size * 2);
+        }
+    }
+    close(fd);
+    if (!mapped) {
+        LOGW("couldn't map input ring (%s)", strerror(errno));
+        return false;
+    }
+
+    mBuffer = (input_event*)base;
+    mBufferEnd = mBuffer + size / sizeof(input_event);
+    mMapSize = size;
+    return true;
+}
+
+void InputEventCircularReader::setFrameRate(int64_t period, size_t frameSize)
+{
+    int64_t wanted = INPUT_READER_MAX_EVENTS;
+    if (period > 0 && INPUT_READER_SPAN / period < wanted) {
+        wanted = (INPUT_READER_SPAN / period + 1) * frameSize;
+    }
+    mWanted = wanted < INPUT_READER_MAX_EVENTS ?
+            size_t(wanted) : size_t(INPUT_READER_MAX_EVENTS);
+}
+
+void InputEventCircularReader::grow(size_t numEvents)
+{
+    input_event* const buffer = mBuffer;
+    input_event* const bufferEnd = mBufferEnd;
+    const size_t mapSize = mMapSize;
+    const size_t capacity = bufferEnd - buffer;
+    const size_t available = capacity - mFreeSpace;
+
+    if (!mapRing(numEvents)) {
+        input_event* heap = new input_event[numEvents * 2];
+        mBuffer = heap;
+        mBufferEnd = heap + numEvents;
+        mMapSize = 0;
+    }
+
+    // the events left move to the start of the new ring, without the
+    // second view they may wrap around the end of the old one
+    size_t first = available;
+    if (!mapSize && first > size_t(bufferEnd - mCurr)) {
+        first = bufferEnd - mCurr;
+    }
+    memcpy(mBuffer, mCurr, first * sizeof(input_event));
+    memcpy(mBuffer + first, buffer, (available - first) * sizeof(input_event));
+    mCurr = mBuffer;
+    mHead = mBuffer + available;
+    mFreeSpace = (mBufferEnd - mBuffer) - available;
+
+    if (mapSize) {
+        munmap(buffer, mapSize * 2);
+    } else {
+        delete [] buffer;
+    }
 }
 
 ssize_t InputEventCircularReader::fill(int fd)
 {
+    if (mWanted > size_t(mBufferEnd - mBuffer)) {
+        grow(mWanted);
+    }
+
     size_t numEventsRead = 0;
     if (mFreeSpace) {
         const ssize_t nread = read(fd, mHead, mFreeSpace * sizeof(input_event));
+        if (nread<0 && errno == EAGAIN) {
+            // nothing new, there may still be events left to read
+            return 0;
+        }
         if (nread<0 || nread % sizeof(input_event)) {
             // we got a partial event!!
             return nread<0 ? -errno : -EINVAL;
@@ -58,11 +167,14 @@ ssize_t InputEventCircularReader::fill(int fd)
 
         numEventsRead = nread / sizeof(input_event);
         if (numEventsRead) {
+            InputTrace::record(fd, mHead, numEventsRead);
             mHead += numEventsRead;
             mFreeSpace -= numEventsRead;
-            if (mHead > mBufferEnd) {
+            if (mHead >= mBufferEnd) {
                 size_t s = mHead - mBufferEnd;
-                memcpy(mBuffer, mBufferEnd, s * sizeof(input_event));
+                if (!mMapSize) {
+                    memcpy(mBuffer, mBufferEnd, s * sizeof(input_event));
+                }
                 mHead = mBuffer + s;
             }
         }
@@ -71,18 +183,23 @@ ssize_t InputEventCircularReader::fill(int fd)
     return numEventsRead;
 }
 
-ssize_t InputEventCircularReader::readEvent(input_event const** events)
+ssize_t InputEventCircularReader::readEvents(input_event const** events) const
 {
     *events = mCurr;
     ssize_t available = (mBufferEnd - mBuffer) - mFreeSpace;
-    return available ? 1 : 0;
+    if (!mMapSize && available > mBufferEnd - mCurr) {
+        // without the second view only the events up to the end are
+        // contiguous
+        available = mBufferEnd - mCurr;
+    }
+    return available;
 }
 
-void InputEventCircularReader::next()
+void InputEventCircularReader::consume(size_t numEvents)
 {
-    mCurr++;
-    mFreeSpace++;
+    mCurr += numEvents;
+    mFreeSpace += numEvents;
     if (mCurr >= mBufferEnd) {
-        mCurr = mBuffer;
+        mCurr -= mBufferEnd - mBuffer;
     }
 }
@@ -26,20 +26,39 @@
 
 struct input_event;
 
+/*
+ * The ring is backed by an ashmem region mapped twice back to back, so
+ * both a read() crossing the end and the span returned by readEvents()
+ * are contiguous in memory. If the double mapping cannot be set up, the
+ * reader falls back to a heap buffer that copies the overflow of a read()
+ * back to the start, and readEvents() stops at the end of the buffer.
+ *
+ * The ring starts at the size given and grows, never shrinks, with the
+ * rate set by setFrameRate(). The growing happens in fill(), on the
+ * thread reading, the events not consumed yet are kept.
+ */
 class InputEventCircularReader
 {
-    struct input_event* const mBuffer;
-    struct input_event* const mBufferEnd;
+    struct input_event* mBuffer;
+    struct input_event* mBufferEnd;
     struct input_event* mHead;
     struct input_event* mCurr;
     ssize_t mFreeSpace;
+    size_t mMapSize;
+    volatile size_t mWanted;
+
+    bool mapRing(size_t numEvents);
+    void grow(size_t numEvents);
 
 public:
     InputEventCircularReader(size_t numEvents);
     ~InputEventCircularReader();
+    // frames of frameSize events come every period ns, may be called
+    // from any thread
+    void setFrameRate(int64_t period, size_t frameSize);
     ssize_t fill(int fd);
-    ssize_t readEvent(input_event const** events);
-    void next();
+    ssize_t readEvents(input_event const** events) const;
+    void consume(size_t numEvents);
 };
 
 /*****************************************************************************/
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INPUT_SENSOR_H
+#define ANDROID_INPUT_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/cdefs.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include <linux/input.h>
+
+#include <cutils/log.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+#include "InputEventReader.h"
+#include "InputDecoder.h"
+#include "SensorStats.h"
+
+/*****************************************************************************/
+
+/*
+ * A sensor reporting one event per EV_SYN terminated frame of an input
+ * device, with up to three axes, enabled and paced through the ioctls of
+ * its control node. Everything that differs from one such sensor to the
+ * next comes from Traits at compile time:
+ *
+ *  struct Traits {
+ *      static const char* const devName;       // control node
+ *      static const char* const inputName;     // input device name
+ *      static const char* const name;          // for the logs
+ *      static const int handle;                // ID_x
+ *      static const int sensorType;            // SENSOR_TYPE_x
+ *      static const bool hasStatus;            // vector with a status
+ *      static const int eventType;             // EV_REL or EV_ABS
+ *      static const int ignoredType;           // also sent, not decoded
+ *      static const int numAxes;
+ *      static const int codes[];               // axis i is data[i]
+ *      static const float scales[];            // to SI units
+ *      static const unsigned long getEnable, setEnable, setDelay;
+ *  };
+ *
+ * There is no constexpr in our compiler, so these are static consts. The
+ * ones that aren't integral are defined next to the explicit instantiation
+ * in the sensor's .cpp, which is the only place the template is expanded,
+ * so the decode loop is built with the tables as constants and unrolled.
+ *
+ * readEvents() works on the whole span the reader hands out: the frames
+ * are gathered into an InputDecoder, converted with SIMD, and the events
+ * written out in a single pass.
+ *
+ * After a SYN_DROPPED the axes go back to the last complete frame and
+ * nothing is reported up to the next SYN_REPORT. The absolute axes are
+ * then read anew with EVIOCGABS, the relative ones come with the next
+ * frame.
+ */
+template <class Traits>
+class InputSensor : public SensorBase {
+    int mEnabled;
+    InputEventCircularReader mInputReader;
+    sensors_event_t mPendingEvent;
+    // last value of each axis, evdev only sends the ones that change
+    int32_t mRaw[Traits::numAxes];
+    // same, as of the last complete frame
+    int32_t mSynced[Traits::numAxes];
+    bool mDropping;
+    InputDecoder<Traits::numAxes> mDecoder;
+
+public:
+            InputSensor();
+    virtual ~InputSensor();
+
+    virtual int enable(int32_t handle, int enabled);
+    virtual bool isEnabled() const;
+    virtual int readEvents(sensors_event_t* data, int count);
+
+protected:
+    virtual int programDelay(int64_t ns);
+
+private:
+    inline void processEvent(int code, int value);
+    void resync();
+};
+
+/*****************************************************************************/
+
+template <class Traits>
+InputSensor<Traits>::InputSensor()
+    : SensorBase(Traits::devName, Traits::inputName),
+      mEnabled(0),
+      mInputReader(32),
+      mDropping(false)
+{
+    memset(mRaw, 0, sizeof(mRaw));
+    memset(&mPendingEvent, 0, sizeof(mPendingEvent));
+    mPendingEvent.version = sizeof(sensors_event_t);
+    mPendingEvent.sensor = Traits::handle;
+    mPendingEvent.type = Traits::sensorType;
+    if (Traits::hasStatus) {
+        mPendingEvent.acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+    }
+
+    open_device();
+
+    // read the actual value of all axes if the sensor is enabled already
+    int flags = 0;
+    if (!ioctl(dev_fd, Traits::getEnable, &flags)) {
+        if (flags)  {
+            mEnabled = 1;
+            resync();
+        }
+    }
+    memcpy(mSynced, mRaw, sizeof(mSynced));
+    if (!mEnabled) {
+        close_device();
+    }
+}
+
+template <class Traits>
+InputSensor<Traits>::~InputSensor() {
+}
+
+template <class Traits>
+int InputSensor<Traits>::enable(int32_t, int en)
+{
+    int flags = en ? 1 : 0;
+    int err = 0;
+    if (flags != mEnabled) {
+        if (flags) {
+            open_device();
+        }
+        err = ioctl(dev_fd, Traits::setEnable, &flags);
+        err = err<0 ? -errno : 0;
+        LOGE_IF(err, "%s: SET_ENABLE failed (%s)", Traits::name, strerror(-err));
+        if (!err) {
+            mEnabled = flags;
+            updateDelay();
+        }
+        if (!flags) {
+            close_device();
+        }
+    }
+    return err;
+}
+
+template <class Traits>
+bool InputSensor<Traits>::isEnabled() const {
+    return mEnabled != 0;
+}
+
+template <class Traits>
+int InputSensor<Traits>::programDelay(int64_t ns)
+{
+    mInputReader.setFrameRate(ns, Traits::numAxes + 1);
+    int delay = ns / 1000000;
+    if (ioctl(dev_fd, Traits::setDelay, &delay)) {
+        return -errno;
+    }
+    return 0;
+}
+
+template <class Traits>
+int InputSensor<Traits>::readEvents(sensors_event_t* data, int count)
+{
+    if (count < 1)
+        return -EINVAL;
+
+    ssize_t n = mInputReader.fill(data_fd);
+    if (n < 0) {
+        SensorStats::fillError(Traits::handle);
+        return n;
+    }
+    updateClockOffset();
+    int numEventReceived = 0;
+    input_event const* event;
+    ssize_t numEvents;
+
+    while (count && (numEvents = mInputReader.readEvents(&event))) {
+        // gather the axes and the time of each complete frame
+        const size_t maxFrames = size_t(count) < size_t(mDecoder.batchSize) ?
+                size_t(count) : size_t(mDecoder.batchSize);
+        size_t frames = 0;
+        ssize_t i;
+        for (i=0 ; frames<maxFrames && i<numEvents ; i++, event++) {
+            int type = event->type;
+            if (type == Traits::eventType) {
+                if (!mDropping) {
+                    processEvent(event->code, event->value);
+                }
+            } else if (type == EV_SYN) {
+                if (event->code == SYN_DROPPED) {
+                    // the frame in progress lost some of its events
+                    memcpy(mRaw, mSynced, sizeof(mRaw));
+                    mDropping = true;
+                    SensorStats::inputOverrun(Traits::handle);
+                } else if (mDropping) {
+                    mDropping = false;
+                    resync();
+                } else {
+                    for (int k=0 ; k<Traits::numAxes ; k++) {
+                        mDecoder.raw[k][frames] = mSynced[k] = mRaw[k];
+                    }
+                    mDecoder.time[frames++] = eventTimestamp(event->time);
+                }
+            } else if (type != Traits::ignoredType) {
+                LOGE("%s: unknown event (type=%d, code=%d)",
+                        Traits::name, type, event->code);
+            }
+        }
+        mInputReader.consume(i);
+        if (!frames)
+            continue;
+
+        SensorStats::eventRead(Traits::handle, frames);
+        if (!mEnabled) {
+            SensorStats::eventDropped(Traits::handle, frames);
+            continue;
+        }
+
+        for (int k=0 ; k<Traits::numAxes ; k++) {
+            mDecoder.convert(k, Traits::scales[k], frames);
+        }
+        for (size_t f=0 ; f<frames ; f++) {
+            *data = mPendingEvent;
+            for (int k=0 ; k<Traits::numAxes ; k++) {
+                data->data[k] = mDecoder.value[k][f];
+            }
+            data->timestamp = mTimestampFilter.filter(mDecoder.time[f]);
+            SensorStats::setKernelTime(data, mDecoder.time[f]);
+            data++;
+        }
+        count -= frames;
+        numEventReceived += frames;
+    }
+
+    return numEventReceived;
+}
+
+template <class Traits>
+void InputSensor<Traits>::resync()
+{
+    if (Traits::eventType == EV_ABS) {
+        struct input_absinfo absinfo;
+        for (int i=0 ; i<Traits::numAxes ; i++) {
+            if (!ioctl(data_fd, EVIOCGABS(Traits::codes[i]), &absinfo)) {
+                mRaw[i] = mSynced[i] = absinfo.value;
+            }
+        }
+    }
+}
+
+template <class Traits>
+void InputSensor<Traits>::processEvent(int code, int value)
+{
+    for (int i=0 ; i<Traits::numAxes ; i++) {
+        if (code == Traits::codes[i]) {
+            mRaw[i] = value;
+            break;
+        }
+    }
+}
+
+/*****************************************************************************/
+
+#endif  // ANDROID_INPUT_SENSOR_H
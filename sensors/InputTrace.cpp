@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+#include "TraceWriter.h"
+#include "TraceReader.h"
+#include "InputTrace.h"
+
+/*****************************************************************************/
+
+// a replayed device nobody reads from gets its events dropped after
+#define WRITE_TIMEOUT_MS    100
+
+pthread_mutex_t InputTrace::sLock = PTHREAD_MUTEX_INITIALIZER;
+InputTrace::Device InputTrace::sDevices[maxDevices];
+size_t InputTrace::sNumDevices = 0;
+volatile bool InputTrace::sRecording = false;
+TraceWriter* InputTrace::sWriter = NULL;
+bool InputTrace::sReplaying = false;
+volatile bool InputTrace::sStopping = false;
+bool InputTrace::sPaced = true;
+int64_t InputTrace::sDelay = 0;
+const char* InputTrace::sReplayPath = NULL;
+bool InputTrace::sReplayPaced = true;
+int64_t InputTrace::sReplayDelay = 0;
+int64_t InputTrace::sUntil = 0;
+TraceReader* InputTrace::sReader = NULL;
+pthread_t InputTrace::sThread;
+int InputTrace::sStopFds[2] = { -1, -1 };
+
+static int64_t now() {
+    struct timespec t;
+    t.tv_sec = t.tv_nsec = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+void InputTrace::start()
+{
+    char mode[PROPERTY_VALUE_MAX];
+    char path[PROPERTY_VALUE_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    property_get("sensors.trace.mode", mode, "");
+    property_get("sensors.trace.file", path, INPUT_TRACE_FILE);
+
+    if (!sReplayPath && !strcmp(mode, "record")) {
+        TraceWriter* writer = new TraceWriter();
+        int err = writer->open(path);
+        if (err) {
+            LOGE("couldn't create input trace %s (%s)", path, strerror(-err));
+            delete writer;
+            return;
+        }
+        pthread_mutex_lock(&sLock);
+        sWriter = writer;
+        sNumDevices = 0;
+        sRecording = true;
+        pthread_mutex_unlock(&sLock);
+        LOGW("recording input events to %s", path);
+    } else if (sReplayPath || !strcmp(mode, "replay")) {
+        const char* file = path;
+        int64_t from = 0;
+        int64_t until = -1;
+        sDelay = 0;
+        if (sReplayPath) {
+            file = sReplayPath;
+            sPaced = sReplayPaced;
+            sDelay = sReplayDelay;
+        } else {
+            property_get("sensors.trace.paced", value, "1");
+            sPaced = atoi(value) != 0;
+            property_get("sensors.trace.from", value, "0");
+            from = atoll(value) * 1000;
+            property_get("sensors.trace.until", value, "-1");
+            until = atoll(value) * 1000;
+        }
+        if (!startReplay(file, from, until)) {
+            SensorBase::setInputProvider(provideInput);
+            LOGW("replaying input events from %s%s", file,
+                    sPaced ? "" : " as fast as possible");
+        }
+    }
+}
+
+void InputTrace::setReplay(const char* path, bool paced, int64_t delay)
+{
+    sReplayPath = path;
+    sReplayPaced = paced;
+    sReplayDelay = delay;
+}
+
+void InputTrace::stop()
+{
+    pthread_mutex_lock(&sLock);
+    if (sRecording) {
+        sRecording = false;
+        delete sWriter;
+        sWriter = NULL;
+    }
+    pthread_mutex_unlock(&sLock);
+
+    if (sReplaying) {
+        sStopping = true;
+        const char msg = 'S';
+        write(sStopFds[1], &msg, 1);
+        pthread_join(sThread, NULL);
+        close(sStopFds[0]);
+        close(sStopFds[1]);
+        sStopFds[0] = sStopFds[1] = -1;
+        for (size_t i=0 ; i<sNumDevices ; i++) {
+            close(sDevices[i].writeFd);
+            if (!sDevices[i].opened) {
+                close(sDevices[i].fd);
+            }
+        }
+        delete sReader;
+        sReader = NULL;
+        sReplaying = false;
+        sStopping = false;
+        SensorBase::setInputProvider(0);
+    }
+    sNumDevices = 0;
+}
+
+void InputTrace::inputOpened(const char* inputName, int fd)
+{
+    if (!sRecording || fd < 0)
+        return;
+
+    pthread_mutex_lock(&sLock);
+    if (sRecording) {
+        int id = sWriter->addDevice(inputName);
+        if (id >= 0) {
+            sDevices[id].fd = fd;
+            sNumDevices = id + 1;
+        }
+    }
+    pthread_mutex_unlock(&sLock);
+}
+
+void InputTrace::recordEvents(int fd, input_event const* events, size_t count)
+{
+    pthread_mutex_lock(&sLock);
+    size_t id = 0;
+    while (id < sNumDevices && sDevices[id].fd != fd)
+        id++;
+    if (sRecording && id < sNumDevices) {
+        sWriter->write(id, events, count);
+    }
+    pthread_mutex_unlock(&sLock);
+}
+
+int InputTrace::startReplay(const char* path, int64_t from, int64_t until)
+{
+    TraceReader* reader = new TraceReader();
+    int err = reader->open(path);
+    if (err) {
+        LOGE("couldn't open input trace %s (%s)", path, strerror(-err));
+        delete reader;
+        return err;
+    }
+
+    // a pipe stands in for each device recorded
+    sNumDevices = 0;
+    while (sNumDevices < reader->getNumDevices() && sNumDevices < maxDevices) {
+        Device* device = &sDevices[sNumDevices];
+        int fds[2];
+        if (pipe(fds) < 0)
+            break;
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        strncpy(device->name, reader->getDeviceName(sNumDevices),
+                sizeof(device->name) - 1);
+        device->name[sizeof(device->name) - 1] = 0;
+        device->fd = fds[0];
+        device->writeFd = fds[1];
+        device->opened = false;
+        device->batched = 0;
+        sNumDevices++;
+    }
+
+    reader->seek(reader->getStartTime() + from);
+    sUntil = until < 0 ? reader->getEndTime() : reader->getStartTime() + until;
+    sReader = reader;
+
+    err = pipe(sStopFds) < 0 ? errno :
+            pthread_create(&sThread, NULL, replayThread, NULL);
+    if (err) {
+        LOGE("couldn't start the input trace replay (%s)", strerror(err));
+        for (size_t i=0 ; i<sNumDevices ; i++) {
+            close(sDevices[i].fd);
+            close(sDevices[i].writeFd);
+        }
+        sNumDevices = 0;
+        delete sReader;
+        sReader = NULL;
+        return -err;
+    }
+    sReplaying = true;
+    return 0;
+}
+
+int InputTrace::provideInput(const char* inputName)
+{
+    int fd = -1;
+    pthread_mutex_lock(&sLock);
+    for (size_t i=0 ; i<sNumDevices ; i++) {
+        if (!sDevices[i].opened && !strcmp(sDevices[i].name, inputName)) {
+            // the driver owns it from now on
+            sDevices[i].opened = true;
+            fd = sDevices[i].fd;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sLock);
+    return fd;
+}
+
+void* InputTrace::replayThread(void*)
+{
+    replay();
+    return NULL;
+}
+
+bool InputTrace::waitUntil(int64_t time)
+{
+    for (;;) {
+        const int64_t left = time - now();
+        if (left <= 0 || sStopping)
+            return !sStopping;
+        if (left >= 1000000) {
+            struct pollfd fd;
+            fd.fd = sStopFds[0];
+            fd.events = POLLIN;
+            if (poll(&fd, 1, left / 1000000) > 0)
+                return false;
+        } else {
+            struct timespec t;
+            t.tv_sec = 0;
+            t.tv_nsec = left;
+            nanosleep(&t, NULL);
+        }
+    }
+}
+
+void InputTrace::send(Device* device)
+{
+    const size_t size = device->batched * sizeof(input_event);
+    device->batched = 0;
+
+    // the pipe fills up when the sensor isn't enabled, or when the HAL
+    // can't keep up in a replay as fast as possible
+    while (write(device->writeFd, device->batch, size) < 0) {
+        if (errno != EAGAIN)
+            return;
+        struct pollfd fds[2];
+        fds[0].fd = device->writeFd;
+        fds[0].events = POLLOUT;
+        fds[1].fd = sStopFds[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, WRITE_TIMEOUT_MS) <= 0 || fds[1].revents) {
+            LOGW_IF(!sStopping, "replay: %s isn't read, dropping events",
+                    device->name);
+            return;
+        }
+    }
+}
+
+void InputTrace::replay()
+{
+    // the recorded times are moved to the time of the replay, each frame
+    // goes out whole
+    const int64_t start = now() + sDelay;
+    if (sDelay && !waitUntil(start))
+        return;
+    int64_t first = -1;
+    size_t id;
+    input_event event;
+    while (!sStopping && sReader->next(&id, &event)) {
+        const int64_t time = int64_t(event.time.tv_sec)*1000000LL +
+                event.time.tv_usec;
+        if (time > sUntil)
+            break;
+        if (id >= sNumDevices)
+            continue;
+        if (first < 0) {
+            first = time;
+        }
+
+        const int64_t replayed = time - first + start / 1000;
+        event.time.tv_sec = replayed / 1000000;
+        event.time.tv_usec = replayed % 1000000;
+        Device* const device = &sDevices[id];
+        device->batch[device->batched++] = event;
+        if (event.type == EV_SYN || device->batched == batchSize) {
+            if (sPaced && !waitUntil(start + (time - first) * 1000))
+                break;
+            send(device);
+        }
+    }
+    for (size_t i=0 ; i<sNumDevices && !sStopping ; i++) {
+        if (sDevices[i].batched) {
+            send(&sDevices[i]);
+        }
+    }
+    LOGW_IF(!sStopping, "input trace replay done");
+}
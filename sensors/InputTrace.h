@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INPUT_TRACE_H
+#define ANDROID_INPUT_TRACE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <linux/input.h>
+
+/*****************************************************************************/
+
+class TraceWriter;
+class TraceReader;
+
+/*
+ * Records the input events of every driver as they are read, or replays
+ * a recording in place of the input devices, depending on the
+ * sensors.trace.mode property ("record" or "replay") when the HAL is
+ * opened. The file is sensors.trace.file, replays are paced at the
+ * recorded timing unless sensors.trace.paced is 0, in which case they go
+ * as fast as the HAL takes them. sensors.trace.from and sensors.trace.until
+ * limit a replay to a range, in ms from the start of the trace. A host
+ * harness, which has no properties, asks for a replay with setReplay().
+ *
+ * The format of the file is in TraceFormat.h.
+ */
+class InputTrace
+{
+public:
+    // reads the properties and starts recording or replaying
+    static void start();
+    static void stop();
+
+    // replays the whole of path when the HAL is opened, whatever the
+    // properties say, from delay ns later so the sensors can be enabled
+    // first; NULL goes back to the properties
+    static void setReplay(const char* path, bool paced, int64_t delay);
+
+    // called by the drivers for each input device opened, and with each
+    // batch of events read from one
+    static void inputOpened(const char* inputName, int fd);
+    static void record(int fd, input_event const* events, size_t count) {
+        if (sRecording)
+            recordEvents(fd, events, count);
+    }
+
+private:
+    enum {
+        maxDevices  = 16,
+        batchSize   = 64,   // events, small enough for one atomic pipe write
+    };
+
+    struct Device {
+        char name[80];
+        int fd;             // recording: the driver's, replay: the read end
+        int writeFd;        // replay only
+        bool opened;
+        input_event batch[batchSize];
+        size_t batched;
+    };
+
+    static pthread_mutex_t sLock;
+    static Device sDevices[maxDevices];
+    static size_t sNumDevices;
+
+    static volatile bool sRecording;
+    static TraceWriter* sWriter;
+
+    static bool sReplaying;
+    static volatile bool sStopping;
+    static bool sPaced;
+    static int64_t sDelay;
+    static const char* sReplayPath;
+    static bool sReplayPaced;
+    static int64_t sReplayDelay;
+    static int64_t sUntil;
+    static TraceReader* sReader;
+    static pthread_t sThread;
+    static int sStopFds[2];
+
+    static void recordEvents(int fd, input_event const* events, size_t count);
+    static int startReplay(const char* path, int64_t from, int64_t until);
+    static int provideInput(const char* inputName);
+    static void* replayThread(void*);
+    static void replay();
+    static bool waitUntil(int64_t time);
+    static void send(Device* device);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_INPUT_TRACE_H
@@ -20,13 +20,17 @@
 #include <poll.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <sys/select.h>
 
 #include <linux/max9635.h>
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "LightSensor.h"
+#include "SensorStats.h"
 
 /*****************************************************************************/
 
@@ -34,12 +38,28 @@ LightSensor::LightSensor()
     : SensorBase(LIGHTING_DEVICE_NAME, "max9635_als"),
       mEnabled(0),
       mInputReader(4),
-      mHasPendingEvent(false)
+      mHasPendingEvent(false),
+      mDropping(false),
+      mNumPoints(0),
+      mHasReported(false),
+      mLastReported(0),
+      mRelativeHysteresis(LIGHT_HYSTERESIS_RELATIVE),
+      mAbsoluteHysteresis(LIGHT_HYSTERESIS_ABSOLUTE)
 {
     mPendingEvent.version = sizeof(sensors_event_t);
     mPendingEvent.sensor = ID_L;
     mPendingEvent.type = SENSOR_TYPE_LIGHT;
     memset(mPendingEvent.data, 0, sizeof(mPendingEvent.data));
+
+    loadCalibration(LIGHT_CALIBRATION_FILE);
+
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("ro.sensors.light.relative", value, NULL) > 0) {
+        mRelativeHysteresis = strtof(value, NULL);
+    }
+    if (property_get("ro.sensors.light.absolute", value, NULL) > 0) {
+        mAbsoluteHysteresis = strtof(value, NULL);
+    }
 }
 
 LightSensor::~LightSensor() {
@@ -57,6 +77,8 @@ int LightSensor::enable(int32_t, int en) {
         LOGE_IF(err, "MAX9635_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
         if (!err) {
             mEnabled = en;
+            // the first reading after enabling always goes out
+            mHasReported = false;
         }
         if (!en) {
             close_device();
@@ -65,6 +87,10 @@ int LightSensor::enable(int32_t, int en) {
     return 0;
 }
 
+bool LightSensor::isEnabled() const {
+    return mEnabled != 0;
+}
+
 bool LightSensor::hasPendingEvents() const {
     return mHasPendingEvent;
 }
@@ -82,40 +108,105 @@ int LightSensor::readEvents(sensors_event_t* data, int count)
     }
 
     ssize_t n = mInputReader.fill(data_fd);
-    if (n < 0)
+    if (n < 0) {
+        SensorStats::fillError(ID_L);
         return n;
+    }
+    updateClockOffset();
 
     int numEventReceived = 0;
     input_event const* event;
-
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if (type == EV_MSC) {
-            if (event->code == EVENT_TYPE_LIGHT) {
-                mPendingEvent.light = indexToValue(event->value);
-            }
-        } else if (type == EV_SYN) {
-            mPendingEvent.timestamp = timevalToNano(event->time);
-            if (mEnabled) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
-            }
-        } else {
-            if (type == 4 && event->code == 3) {
-                // weird, not sure why we're getting this all the time
+    ssize_t numEvents;
+
+    while (count && (numEvents = mInputReader.readEvents(&event))) {
+        ssize_t i;
+        for (i=0 ; count && i<numEvents ; i++, event++) {
+            int type = event->type;
+            if (type == EV_MSC) {
+                if (event->code == EVENT_TYPE_LIGHT && !mDropping) {
+                    mPendingEvent.light = indexToValue(event->value);
+                }
+            } else if (type == EV_SYN && event->code == SYN_DROPPED) {
+                mDropping = true;
+                SensorStats::inputOverrun(ID_L);
+            } else if (type == EV_SYN && mDropping) {
+                mDropping = false;
+            } else if (type == EV_SYN) {
+                mPendingEvent.timestamp = eventTimestamp(event->time);
+                SensorStats::eventRead(ID_L);
+                if (mEnabled && hasChanged(mPendingEvent.light)) {
+                    mHasReported = true;
+                    mLastReported = mPendingEvent.light;
+                    *data++ = mPendingEvent;
+                    count--;
+                    numEventReceived++;
+                } else {
+                    SensorStats::eventDropped(ID_L);
+                }
             } else {
-                LOGE("LightSensor: unknown event (type=%d, code=%d)",
-                        type, event->code);
+                if (type == 4 && event->code == 3) {
+                    // weird, not sure why we're getting this all the time
+                } else {
+                    LOGE("LightSensor: unknown event (type=%d, code=%d)",
+                            type, event->code);
+                }
             }
         }
-        mInputReader.next();
+        mInputReader.consume(i);
     }
 
     return numEventReceived;
 }
 
+int LightSensor::loadCalibration(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -errno;
+
+    char line[128];
+    size_t n = 0;
+    while (n < maxCalibrationPoints && fgets(line, sizeof(line), file)) {
+        float index, lux;
+        if (line[0] == '#' || sscanf(line, "%f %f", &index, &lux) != 2)
+            continue;
+        if (index < 0 || lux < 0 || (n && index <= mIndices[n-1])) {
+            LOGE("%s: ignoring point %g %g, indices must increase",
+                    path, index, lux);
+            continue;
+        }
+        mIndices[n] = index;
+        mLux[n] = lux;
+        n++;
+    }
+    fclose(file);
+    mNumPoints = n;
+    return 0;
+}
+
 float LightSensor::indexToValue(size_t index) const
 {
-    return float(index);
+    const float x = float(index);
+    if (mNumPoints == 0)
+        return x;
+    if (mNumPoints == 1)
+        return mIndices[0] > 0 ? x * mLux[0] / mIndices[0] : mLux[0];
+
+    // linear between the points, and along the first or last segment
+    // outside of them
+    size_t i = 1;
+    while (i < mNumPoints-1 && x > mIndices[i])
+        i++;
+    const float t = (x - mIndices[i-1]) / (mIndices[i] - mIndices[i-1]);
+    const float lux = mLux[i-1] + t * (mLux[i] - mLux[i-1]);
+    return lux > 0 ? lux : 0;
+}
+
+bool LightSensor::hasChanged(float lux) const
+{
+    if (!mHasReported)
+        return true;
+    const float delta = fabsf(lux - mLastReported);
+    return delta > mAbsoluteHysteresis &&
+            delta > mRelativeHysteresis * mLastReported;
 }
@@ -31,12 +31,30 @@
 struct input_event;
 
 class LightSensor : public SensorBase {
+    enum { maxCalibrationPoints = 32 };
+
     int mEnabled;
     InputEventCircularReader mInputReader;
     sensors_event_t mPendingEvent;
     bool mHasPendingEvent;
+    bool mDropping;         // up to the SYN_REPORT after a SYN_DROPPED
+
+    // index to lux points, sorted by index; none means the index is the
+    // value in lux
+    size_t mNumPoints;
+    float mIndices[maxCalibrationPoints];
+    float mLux[maxCalibrationPoints];
+
+    // on-change filter: the last value reported and how far the light
+    // has to move from it to be reported again
+    bool mHasReported;
+    float mLastReported;
+    float mRelativeHysteresis;
+    float mAbsoluteHysteresis;
 
+    int loadCalibration(const char* path);
     float indexToValue(size_t index) const;
+    bool hasChanged(float lux) const;
 
 public:
             LightSensor();
@@ -44,6 +62,7 @@ public:
     virtual int readEvents(sensors_event_t* data, int count);
     virtual bool hasPendingEvents() const;
     virtual int enable(int32_t handle, int enabled);
+    virtual bool isEnabled() const;
 };
 
 /*****************************************************************************/
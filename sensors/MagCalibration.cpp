@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "nusensors.h"
+#include "MagCalibration.h"
+
+/*****************************************************************************/
+
+// cells needed before fitting, out of 32
+#define MIN_CELLS           12
+// samples replacing older ones before the fit is redone
+#define REFIT_INTERVAL      64
+// the earth's field is between 25 and 65 uT, leave some margin
+#define MIN_FIELD           15.0f
+#define MAX_FIELD           100.0f
+// no soft iron seen on a phone stretches an axis more than this
+#define MAX_AXIS_RATIO      1.5f
+// rms distance of the cells to the sphere, relative to its radius, for
+// each accuracy, and the number of cells each needs
+#define RMS_HIGH            0.02
+#define CELLS_HIGH          24
+#define RMS_MEDIUM          0.05
+#define CELLS_MEDIUM        16
+#define RMS_LOW             0.10
+// above this the cells are from another environment, start over
+#define RMS_RESET           0.15
+// a saved calibration is updated when its offset moved this much, in uT
+#define SAVE_DISTANCE       2.0f
+
+/*****************************************************************************/
+
+// eigenvalues (left on the diagonal of a) and vectors (columns of v) of a
+// symmetric matrix, by Jacobi rotations
+static void eigen3(double a[3][3], double v[3][3])
+{
+    for (int i=0 ; i<3 ; i++)
+        for (int j=0 ; j<3 ; j++)
+            v[i][j] = i == j ? 1 : 0;
+
+    for (int sweep=0 ; sweep<16 ; sweep++) {
+        const double off = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+        const double diag = a[0][0]*a[0][0] + a[1][1]*a[1][1] + a[2][2]*a[2][2];
+        if (off <= 1e-24 * diag)
+            break;
+        for (int p=0 ; p<2 ; p++) {
+            for (int q=p+1 ; q<3 ; q++) {
+                if (a[p][q] == 0)
+                    continue;
+                const double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+                const double t = (theta >= 0 ? 1 : -1) /
+                        (fabs(theta) + sqrt(theta*theta + 1));
+                const double c = 1 / sqrt(t*t + 1);
+                const double s = t * c;
+                for (int k=0 ; k<3 ; k++) {
+                    const double akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c*akp - s*akq;
+                    a[k][q] = s*akp + c*akq;
+                }
+                for (int k=0 ; k<3 ; k++) {
+                    const double apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c*apk - s*aqk;
+                    a[q][k] = s*apk + c*aqk;
+                }
+                for (int k=0 ; k<3 ; k++) {
+                    const double vkp = v[k][p], vkq = v[k][q];
+                    v[k][p] = c*vkp - s*vkq;
+                    v[k][q] = s*vkp + c*vkq;
+                }
+            }
+        }
+    }
+}
+
+// solves a x = b in place by gaussian elimination, b gets x
+static bool solve(double a[9][9], double b[9])
+{
+    for (int i=0 ; i<9 ; i++) {
+        int pivot = i;
+        for (int r=i+1 ; r<9 ; r++) {
+            if (fabs(a[r][i]) > fabs(a[pivot][i]))
+                pivot = r;
+        }
+        if (fabs(a[pivot][i]) < 1e-12)
+            return false;
+        if (pivot != i) {
+            for (int k=0 ; k<9 ; k++) {
+                double t = a[i][k]; a[i][k] = a[pivot][k]; a[pivot][k] = t;
+            }
+            double t = b[i]; b[i] = b[pivot]; b[pivot] = t;
+        }
+        for (int r=i+1 ; r<9 ; r++) {
+            const double f = a[r][i] / a[i][i];
+            for (int k=i ; k<9 ; k++)
+                a[r][k] -= f * a[i][k];
+            b[r] -= f * b[i];
+        }
+    }
+    for (int i=8 ; i>=0 ; i--) {
+        for (int k=i+1 ; k<9 ; k++)
+            b[i] -= a[i][k] * b[k];
+        b[i] /= a[i][i];
+    }
+    return true;
+}
+
+/*****************************************************************************/
+
+MagCalibration::MagCalibration()
+    : mRadius(0),
+      mAccuracy(SENSOR_STATUS_UNRELIABLE),
+      mHasFit(false),
+      mPath(NULL),
+      mSavedAccuracy(SENSOR_STATUS_UNRELIABLE),
+      mUnsaved(false)
+{
+    for (int i=0 ; i<3 ; i++) {
+        mOffset[i] = 0;
+        mSavedOffset[i] = 0;
+        for (int j=0 ; j<3 ; j++)
+            mMatrix[i][j] = i == j ? 1 : 0;
+    }
+    clear();
+}
+
+void MagCalibration::clear()
+{
+    memset(mCells, 0, sizeof(mCells));
+    memset(mSum, 0, sizeof(mSum));
+    mNumCells = 0;
+    mSinceFit = 0;
+}
+
+int MagCalibration::load(const char* path)
+{
+    mPath = path;
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -errno;
+
+    float o[3], m[9], radius;
+    int accuracy;
+    int n = fscanf(file, "%f %f %f %f %f %f %f %f %f %f %f %f %f %d",
+            &o[0], &o[1], &o[2], &m[0], &m[1], &m[2], &m[3], &m[4], &m[5],
+            &m[6], &m[7], &m[8], &radius, &accuracy);
+    fclose(file);
+    if (n != 14 || !(radius >= MIN_FIELD && radius <= MAX_FIELD)) {
+        LOGW("ignoring bad magnetometer calibration in %s", path);
+        return -EINVAL;
+    }
+
+    for (int i=0 ; i<3 ; i++) {
+        mOffset[i] = mSavedOffset[i] = o[i];
+        for (int j=0 ; j<3 ; j++)
+            mMatrix[i][j] = m[i*3 + j];
+    }
+    mRadius = radius;
+    mSavedAccuracy = accuracy;
+    // the device may have moved to another case or car mount since
+    mAccuracy = accuracy >= SENSOR_STATUS_ACCURACY_HIGH ?
+            SENSOR_STATUS_ACCURACY_MEDIUM : SENSOR_STATUS_ACCURACY_LOW;
+    mHasFit = true;
+    return 0;
+}
+
+void MagCalibration::commit()
+{
+    if (mUnsaved) {
+        mUnsaved = false;
+        save();
+    }
+}
+
+void MagCalibration::save()
+{
+    if (!mPath)
+        return;
+
+    // write a new file and move it over, a crash never leaves half of one
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", mPath);
+    FILE* file = fopen(tmp, "w");
+    if (!file) {
+        LOGE("couldn't save magnetometer calibration (%s)", strerror(errno));
+        return;
+    }
+    fprintf(file, "%f %f %f", mOffset[0], mOffset[1], mOffset[2]);
+    for (int i=0 ; i<3 ; i++)
+        fprintf(file, " %f %f %f", mMatrix[i][0], mMatrix[i][1], mMatrix[i][2]);
+    fprintf(file, " %f %d\n", mRadius, mAccuracy);
+    if (fclose(file) || rename(tmp, mPath)) {
+        LOGE("couldn't save magnetometer calibration (%s)", strerror(errno));
+        unlink(tmp);
+        return;
+    }
+    memcpy(mSavedOffset, mOffset, sizeof(mSavedOffset));
+    mSavedAccuracy = mAccuracy;
+}
+
+int MagCalibration::getAccuracy() const
+{
+    return mAccuracy;
+}
+
+void MagCalibration::apply(const float* field, float* out) const
+{
+    const float x = field[0] - mOffset[0];
+    const float y = field[1] - mOffset[1];
+    const float z = field[2] - mOffset[2];
+    for (int i=0 ; i<3 ; i++)
+        out[i] = mMatrix[i][0]*x + mMatrix[i][1]*y + mMatrix[i][2]*z;
+}
+
+int MagCalibration::cellOf(const float* v) const
+{
+    // around the current center: the fitted one, or the middle of what we
+    // have so far
+    float d[3];
+    for (int i=0 ; i<3 ; i++) {
+        const float center = mHasFit ? mOffset[i] :
+                (mNumCells ? mSum[i] / mNumCells : 0);
+        d[i] = v[i] - center;
+    }
+    const float norm = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    if (norm <= 0)
+        return 0;
+
+    // bands of equal area, then sectors
+    int e = int((d[2] / norm + 1) * 0.5f * elevations);
+    int a = int((atan2f(d[1], d[0]) + float(M_PI)) * (azimuths / (2 * M_PI)));
+    e = e < 0 ? 0 : (e >= elevations ? elevations - 1 : e);
+    a = a < 0 ? 0 : (a >= azimuths ? azimuths - 1 : a);
+    return e * azimuths + a;
+}
+
+void MagCalibration::addSample(const float* field)
+{
+    if (field[0] == 0 && field[1] == 0 && field[2] == 0)
+        return;
+
+    Cell& cell = mCells[cellOf(field)];
+    const bool filled = !cell.used;
+    if (cell.used) {
+        for (int i=0 ; i<3 ; i++)
+            mSum[i] -= cell.v[i];
+    } else {
+        cell.used = true;
+        mNumCells++;
+    }
+    for (int i=0 ; i<3 ; i++) {
+        cell.v[i] = field[i];
+        mSum[i] += field[i];
+    }
+
+    mSinceFit++;
+    if (mNumCells >= MIN_CELLS && (filled || mSinceFit >= REFIT_INTERVAL)) {
+        mSinceFit = 0;
+        fit();
+    }
+}
+
+bool MagCalibration::fit()
+{
+    // work around the mean of the cells, scaled to about 1, to keep the
+    // normal equations well conditioned
+    double mean[3], scale = 0;
+    for (int i=0 ; i<3 ; i++)
+        mean[i] = mSum[i] / mNumCells;
+    for (int c=0 ; c<numCells ; c++) {
+        if (!mCells[c].used)
+            continue;
+        for (int i=0 ; i<3 ; i++) {
+            const double d = mCells[c].v[i] - mean[i];
+            scale += d*d;
+        }
+    }
+    scale = sqrt(scale / mNumCells);
+    if (scale <= 0)
+        return false;
+
+    // x'Ax + 2b'x = 1, least squares over the cells
+    double n[9][9], r[9];
+    memset(n, 0, sizeof(n));
+    memset(r, 0, sizeof(r));
+    for (int c=0 ; c<numCells ; c++) {
+        if (!mCells[c].used)
+            continue;
+        const double x = (mCells[c].v[0] - mean[0]) / scale;
+        const double y = (mCells[c].v[1] - mean[1]) / scale;
+        const double z = (mCells[c].v[2] - mean[2]) / scale;
+        const double phi[9] = { x*x, y*y, z*z, 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z };
+        for (int i=0 ; i<9 ; i++) {
+            for (int j=0 ; j<9 ; j++)
+                n[i][j] += phi[i] * phi[j];
+            r[i] += phi[i];
+        }
+    }
+    if (!solve(n, r))
+        return false;
+
+    double a[3][3] = {
+        { r[0], r[3], r[4] },
+        { r[3], r[1], r[5] },
+        { r[4], r[5], r[2] },
+    };
+    const double b[3] = { r[6], r[7], r[8] };
+
+    // the center solves Ac = -b, and (x-c)'A(x-c) = 1 + c'Ac
+    const double det = a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+                     - a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+                     + a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+    if (fabs(det) < 1e-12)
+        return false;
+    double inv[3][3];
+    for (int i=0 ; i<3 ; i++) {
+        for (int j=0 ; j<3 ; j++) {
+            const int i1 = (j+1)%3, i2 = (j+2)%3;
+            const int j1 = (i+1)%3, j2 = (i+2)%3;
+            inv[i][j] = (a[i1][j1]*a[i2][j2] - a[i1][j2]*a[i2][j1]) / det;
+        }
+    }
+    double center[3], k = 1;
+    for (int i=0 ; i<3 ; i++)
+        center[i] = -(inv[i][0]*b[0] + inv[i][1]*b[1] + inv[i][2]*b[2]);
+    for (int i=0 ; i<3 ; i++)
+        for (int j=0 ; j<3 ; j++)
+            k += center[i] * a[i][j] * center[j];
+    if (k <= 0)
+        return false;
+
+    // back to uT: the ellipsoid is (x-c)'M(x-c) = 1
+    double m[3][3], v[3][3];
+    for (int i=0 ; i<3 ; i++)
+        for (int j=0 ; j<3 ; j++)
+            m[i][j] = a[i][j] / (k * scale * scale);
+    eigen3(m, v);
+    const double l0 = m[0][0], l1 = m[1][1], l2 = m[2][2];
+    if (l0 <= 0 || l1 <= 0 || l2 <= 0)
+        return false;
+    double lmin = l0, lmax = l0;
+    if (l1 < lmin) lmin = l1;
+    if (l2 < lmin) lmin = l2;
+    if (l1 > lmax) lmax = l1;
+    if (l2 > lmax) lmax = l2;
+    if (sqrt(lmax / lmin) > MAX_AXIS_RATIO)
+        return false;
+    const double radius = pow(l0 * l1 * l2, -1.0/6);
+    if (radius < MIN_FIELD || radius > MAX_FIELD)
+        return false;
+
+    // W = R M^1/2 maps the ellipsoid onto the sphere of radius R
+    const double s[3] = { sqrt(l0) * radius, sqrt(l1) * radius, sqrt(l2) * radius };
+    float matrix[3][3], offset[3];
+    for (int i=0 ; i<3 ; i++) {
+        offset[i] = float(mean[i] + center[i] * scale);
+        for (int j=0 ; j<3 ; j++) {
+            matrix[i][j] = float(v[i][0]*s[0]*v[j][0] +
+                    v[i][1]*s[1]*v[j][1] + v[i][2]*s[2]*v[j][2]);
+        }
+    }
+
+    // how far the corrected cells are from the sphere
+    double rms = 0;
+    for (int c=0 ; c<numCells ; c++) {
+        if (!mCells[c].used)
+            continue;
+        double norm = 0;
+        for (int i=0 ; i<3 ; i++) {
+            double w = 0;
+            for (int j=0 ; j<3 ; j++)
+                w += matrix[i][j] * (mCells[c].v[j] - offset[j]);
+            norm += w*w;
+        }
+        const double e = sqrt(norm) / radius - 1;
+        rms += e*e;
+    }
+    rms = sqrt(rms / mNumCells);
+
+    int accuracy;
+    if (rms < RMS_HIGH && mNumCells >= CELLS_HIGH) {
+        accuracy = SENSOR_STATUS_ACCURACY_HIGH;
+    } else if (rms < RMS_MEDIUM && mNumCells >= CELLS_MEDIUM) {
+        accuracy = SENSOR_STATUS_ACCURACY_MEDIUM;
+    } else if (rms < RMS_LOW) {
+        accuracy = SENSOR_STATUS_ACCURACY_LOW;
+    } else {
+        if (rms > RMS_RESET) {
+            clear();
+        }
+        return false;
+    }
+
+    memcpy(mOffset, offset, sizeof(mOffset));
+    memcpy(mMatrix, matrix, sizeof(mMatrix));
+    mRadius = float(radius);
+    mAccuracy = accuracy;
+    mHasFit = true;
+
+    // compared with what's on disk, so a worse fit since the last good
+    // one takes the flag back
+    mUnsaved = false;
+    if (mAccuracy >= SENSOR_STATUS_ACCURACY_MEDIUM) {
+        const float dx = mOffset[0] - mSavedOffset[0];
+        const float dy = mOffset[1] - mSavedOffset[1];
+        const float dz = mOffset[2] - mSavedOffset[2];
+        mUnsaved = mAccuracy > mSavedAccuracy ||
+                dx*dx + dy*dy + dz*dz > SAVE_DISTANCE * SAVE_DISTANCE;
+    }
+    return true;
+}
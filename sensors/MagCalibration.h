@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MAG_CALIBRATION_H
+#define ANDROID_MAG_CALIBRATION_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Hard and soft iron calibration of the magnetometer. The samples are
+ * kept on a sphere of cells by direction, one sample per cell, so the
+ * memory is bounded and a device held still doesn't skew the fit; adding
+ * one is O(1). Once enough of the sphere is covered an ellipsoid is
+ * fitted to the cells, again each time a new cell fills or after a while,
+ * giving the offset and the matrix that maps the ellipsoid back onto a
+ * sphere of the same volume. How well the cells lie on it gives the
+ * accuracy.
+ *
+ * A calibration good enough to keep is saved to a file by commit() and
+ * restored by load(), with one level of accuracy less until a new fit
+ * confirms it. Fits happen on the event path, so they only flag it.
+ */
+class MagCalibration
+{
+public:
+            MagCalibration();
+
+    // restores the calibration from path, which later fits are saved to
+    int load(const char* path);
+
+    // takes an uncalibrated sample, in uT
+    void addSample(const float* field);
+
+    // corrects a sample
+    void apply(const float* field, float* out) const;
+
+    // SENSOR_STATUS_ACCURACY_xxx
+    int getAccuracy() const;
+
+    // writes the calibration out if it changed enough since it was last
+    // saved, this does file I/O
+    void commit();
+
+private:
+    enum {
+        elevations  = 4,
+        azimuths    = 8,
+        numCells    = elevations * azimuths,
+    };
+
+    struct Cell {
+        float v[3];
+        bool used;
+    };
+
+    Cell mCells[numCells];
+    int mNumCells;
+    float mSum[3];      // of the samples in the cells
+    int mSinceFit;
+
+    float mOffset[3];
+    float mMatrix[3][3];
+    float mRadius;
+    int mAccuracy;
+    bool mHasFit;
+
+    const char* mPath;
+    float mSavedOffset[3];
+    int mSavedAccuracy;
+    bool mUnsaved;      // the last fit is worth saving
+
+    void clear();
+    int cellOf(const float* v) const;
+    bool fit();
+    void save();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_MAG_CALIBRATION_H
@@ -15,122 +15,115 @@
  * limitations under the License.
  */
 
-#include <fcntl.h>
 #include <errno.h>
-#include <math.h>
-#include <poll.h>
-#include <unistd.h>
-#include <dirent.h>
-#include <sys/select.h>
+#include <stdlib.h>
 
 #include <linux/bmp085.h>
 
-#include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "PressureSensor.h"
 
 /*****************************************************************************/
 
+const char* const PressureTraits::devName = BAROMETER_DEVICE_NAME;
+const char* const PressureTraits::inputName = "barometer";
+const char* const PressureTraits::name = "PressureSensor";
+
+const int PressureTraits::codes[] = {
+        EVENT_TYPE_PRESSURE
+};
+const float PressureTraits::scales[] = {
+        CONVERT_B
+};
+
+const unsigned long PressureTraits::getEnable = BMP085_IOCTL_GET_ENABLE;
+const unsigned long PressureTraits::setEnable = BMP085_IOCTL_SET_ENABLE;
+const unsigned long PressureTraits::setDelay  = BMP085_IOCTL_SET_DELAY;
+
+template class InputSensor<PressureTraits>;
+
+/*****************************************************************************/
+
 PressureSensor::PressureSensor()
-    : SensorBase(BAROMETER_DEVICE_NAME, "barometer"),
-      mEnabled(0),
-      mInputReader(32)
+    : mOversampling(PRESSURE_OVERSAMPLING),
+      mSmoothing(PRESSURE_SMOOTHING)
 {
-    mPendingEvent.version = sizeof(sensors_event_t);
-    mPendingEvent.sensor = ID_B;
-    mPendingEvent.type = SENSOR_TYPE_PRESSURE;
-    memset(mPendingEvent.data, 0x00, sizeof(mPendingEvent.data));
-
-    open_device();
-
-    // read the actual value of all sensors if they're enabled already
-    struct input_absinfo absinfo;
-    int flags = 0;
-    if (!ioctl(dev_fd, BMP085_IOCTL_GET_ENABLE, &flags)) {
-        if (flags)  {
-            mEnabled = 1;
-            if (!ioctl(data_fd, EVIOCGABS(EVENT_TYPE_PRESSURE), &absinfo)) {
-                mPendingEvent.pressure = absinfo.value * CONVERT_B;
-            }
-        }
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("ro.sensors.pressure.oversampling", value, NULL) > 0) {
+        mOversampling = atoi(value);
+        if (mOversampling < 1)
+            mOversampling = 1;
     }
-    if (!mEnabled) {
-        close_device();
+    if (property_get("ro.sensors.pressure.smoothing", value, NULL) > 0) {
+        mSmoothing = strtof(value, NULL);
+        if (mSmoothing <= 0 || mSmoothing > 1)
+            mSmoothing = 1;
     }
+    reset();
 }
 
 PressureSensor::~PressureSensor() {
 }
 
-int PressureSensor::enable(int32_t, int en)
-{
-    int flags = en ? 1 : 0;
-    int err = 0;
-    if (flags != mEnabled) {
-        if (flags) {
-            open_device();
-        }
-        err = ioctl(dev_fd, BMP085_IOCTL_SET_ENABLE, &flags);
-        err = err<0 ? -errno : 0;
-        LOGE_IF(err, "BMP085_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
-        if (!err) {
-            mEnabled = flags;
-        }
-        if (!flags) {
-            close_device();
-        }
-    }
-    return err;
+void PressureSensor::reset() {
+    mNumSamples = 0;
+    mSum = 0;
+    mFirstTime = 0;
+    mHasFiltered = false;
 }
 
-int PressureSensor::setDelay(int32_t handle, int64_t ns)
-{
-    if (ns < 0)
-        return -EINVAL;
-
-    int delay = ns / 1000000;
-    if (ioctl(dev_fd, BMP085_IOCTL_SET_DELAY, &delay)) {
-        return -errno;
+int PressureSensor::enable(int32_t handle, int en) {
+    if (en && !isEnabled()) {
+        reset();
     }
-    return 0;
+    return InputSensor<PressureTraits>::enable(handle, en);
 }
 
-int PressureSensor::readEvents(sensors_event_t* data, int count)
-{
-    if (count < 1)
-        return -EINVAL;
+int PressureSensor::programDelay(int64_t ns) {
+    return InputSensor<PressureTraits>::programDelay(ns / mOversampling);
+}
 
-    ssize_t n = mInputReader.fill(data_fd);
-    if (n < 0)
-        return n;
+int PressureSensor::readEvents(sensors_event_t* data, int count) {
+    // read until count events came out of the filter or the driver is
+    // drained, so that returning less than count still means there is
+    // nothing left
     int numEventReceived = 0;
-    input_event const* event;
-
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if (type == EV_ABS) {
-            processEvent(event->code, event->value);
-        } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            mPendingEvent.timestamp = time;
-            if (mEnabled) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
-            }
-        } else {
-            LOGE("PressureSensor: unknown event (type=%d, code=%d)",
-                    type, event->code);
-        }
-        mInputReader.next();
+    while (numEventReceived < count) {
+        const int room = count - numEventReceived;
+        int n = InputSensor<PressureTraits>::readEvents(
+                data + numEventReceived, room);
+        if (n < 0)
+            return numEventReceived ? numEventReceived : n;
+        numEventReceived += filter(data + numEventReceived, n);
+        if (n < room)
+            break;
     }
-
     return numEventReceived;
 }
 
-void PressureSensor::processEvent(int code, int value)
-{
-    if (code == EVENT_TYPE_PRESSURE) {
-            mPendingEvent.pressure = value * CONVERT_B;
+int PressureSensor::filter(sensors_event_t* data, int count) {
+    int numEvents = 0;
+    for (int i=0 ; i<count ; i++) {
+        if (!mNumSamples) {
+            mFirstTime = data[i].timestamp;
+        }
+        mSum += data[i].pressure;
+        if (++mNumSamples < mOversampling)
+            continue;
+
+        const float average = mSum / mNumSamples;
+        mFiltered = mHasFiltered ?
+                mFiltered + mSmoothing * (average - mFiltered) : average;
+        mHasFiltered = true;
+
+        // the average stands for the middle of the samples it covers
+        sensors_event_t* ev = &data[numEvents++];
+        *ev = data[i];
+        ev->pressure = mFiltered;
+        ev->timestamp = mFirstTime + (data[i].timestamp - mFirstTime) / 2;
+        mNumSamples = 0;
+        mSum = 0;
     }
+    return numEvents;
 }
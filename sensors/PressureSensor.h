@@ -25,26 +25,52 @@
 
 
 #include "nusensors.h"
-#include "SensorBase.h"
-#include "InputEventReader.h"
+#include "InputSensor.h"
 
 /*****************************************************************************/
 
-struct input_event;
+struct PressureTraits {
+    static const char* const devName;
+    static const char* const inputName;
+    static const char* const name;
+    static const int handle = ID_B;
+    static const int sensorType = SENSOR_TYPE_PRESSURE;
+    static const bool hasStatus = false;
+    static const int eventType = EV_ABS;
+    static const int ignoredType = -1;
+    static const int numAxes = 1;
+    static const int codes[numAxes];
+    static const float scales[numAxes];
+    static const unsigned long getEnable;
+    static const unsigned long setEnable;
+    static const unsigned long setDelay;
+};
+
+/*
+ * The BMP085 is run PRESSURE_OVERSAMPLING times faster than the fastest
+ * consumer asks for, and each group of samples is averaged and smoothed
+ * into one event.
+ */
+class PressureSensor : public InputSensor<PressureTraits> {
+    int mOversampling;
+    float mSmoothing;
+    int mNumSamples;
+    float mSum;
+    int64_t mFirstTime;
+    float mFiltered;
+    bool mHasFiltered;
 
-class PressureSensor : public SensorBase {
-    int mEnabled;
-    InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvent;
+    void reset();
+    int filter(sensors_event_t* data, int count);
 
 public:
             PressureSensor();
     virtual ~PressureSensor();
-
-    virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled);
     virtual int readEvents(sensors_event_t* data, int count);
-    void processEvent(int code, int value);
+
+protected:
+    virtual int programDelay(int64_t ns);
 };
 
 /*****************************************************************************/
@@ -21,22 +21,48 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/select.h>
+#include <time.h>
 
 #include <cutils/log.h>
 
 #include <linux/input.h>
 
 #include "SensorBase.h"
+#include "InputDeviceIndex.h"
+#include "InputTrace.h"
 
 /*****************************************************************************/
 
+#ifndef EVIOCSCLOCKID
+#define EVIOCSCLOCKID   _IOW('E', 0xa0, int)
+#endif
+
+SensorBase::input_provider_t SensorBase::sInputProvider = 0;
+
 SensorBase::SensorBase(
         const char* dev_name,
         const char* data_name)
     : dev_name(dev_name), data_name(data_name),
-      dev_fd(-1), data_fd(-1)
+      dev_fd(-1), data_fd(-1),
+      mMonotonicEvents(false),
+      mClockOffset(0)
 {
-    data_fd = openInput(data_name);
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++)
+        mDelays[i] = -1;
+
+    bool provided = false;
+    data_fd = openInput(data_name, &provided);
+    if (data_fd >= 0) {
+        // readEvents() may be called again with events left in the reader
+        // and nothing new on the fd, this must not block
+        fcntl(data_fd, F_SETFL, O_NONBLOCK);
+
+        // have evdev stamp the events on the same time base as the
+        // framework, kernels before 3.4 don't know how to
+        int clockId = CLOCK_MONOTONIC;
+        mMonotonicEvents = provided ||
+                !ioctl(data_fd, EVIOCSCLOCKID, &clockId);
+    }
 }
 
 SensorBase::~SensorBase() {
@@ -68,7 +94,36 @@ int SensorBase::getFd() const {
     return data_fd;
 }
 
-int SensorBase::setDelay(int32_t handle, int64_t ns) {
+int SensorBase::setDelay(int32_t consumer, int64_t ns) {
+    if (uint32_t(consumer) >= NUM_SENSOR_HANDLES)
+        return -EINVAL;
+    if (ns < 0)
+        ns = -1;
+    if (mDelays[consumer] == ns)
+        return 0;
+    mDelays[consumer] = ns;
+    return updateDelay();
+}
+
+int64_t SensorBase::getDelay() const {
+    int64_t wanted = -1;
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+        if (mDelays[i] >= 0 && (wanted < 0 || mDelays[i] < wanted))
+            wanted = mDelays[i];
+    }
+    return wanted;
+}
+
+int SensorBase::updateDelay() {
+    const int64_t wanted = getDelay();
+    if (wanted < 0 || !isEnabled())
+        return 0;
+    // the old sample clock doesn't tell anything about the new one
+    mTimestampFilter.reset();
+    return programDelay(wanted);
+}
+
+int SensorBase::programDelay(int64_t ns) {
     return 0;
 }
 
@@ -83,40 +138,25 @@ int64_t SensorBase::getTimestamp() {
     return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
 }
 
-int SensorBase::openInput(const char* inputName) {
-    int fd = -1;
-    const char *dirname = "/dev/input";
-    char devname[PATH_MAX];
-    char *filename;
-    DIR *dir;
-    struct dirent *de;
-    dir = opendir(dirname);
-    if(dir == NULL)
-        return -1;
-    strcpy(devname, dirname);
-    filename = devname + strlen(devname);
-    *filename++ = '/';
-    while((de = readdir(dir))) {
-        if(de->d_name[0] == '.' &&
-                (de->d_name[1] == '\0' ||
-                        (de->d_name[1] == '.' && de->d_name[2] == '\0')))
-            continue;
-        strcpy(filename, de->d_name);
-        fd = open(devname, O_RDONLY);
-        if (fd>=0) {
-            char name[80];
-            if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), &name) < 1) {
-                name[0] = '\0';
-            }
-            if (!strcmp(name, inputName)) {
-                break;
-            } else {
-                close(fd);
-                fd = -1;
-            }
-        }
+void SensorBase::updateClockOffset() {
+    if (mMonotonicEvents)
+        return;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const int64_t realtime = int64_t(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+    mClockOffset = realtime - getTimestamp();
+}
+
+void SensorBase::setInputProvider(input_provider_t provider) {
+    sInputProvider = provider;
+}
+
+int SensorBase::openInput(const char* inputName, bool* provided) {
+    int fd = sInputProvider ? sInputProvider(inputName) : -1;
+    *provided = fd >= 0;
+    if (fd < 0) {
+        fd = InputDeviceIndex::openDevice(inputName);
     }
-    closedir(dir);
-    LOGE_IF(fd<0, "couldn't find '%s' input device", inputName);
+    InputTrace::inputOpened(inputName, fd);
     return fd;
 }
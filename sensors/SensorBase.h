@@ -22,19 +22,46 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
+#include "nusensors.h"
+#include "TimestampFilter.h"
 
 /*****************************************************************************/
 
 struct sensors_event_t;
 
 class SensorBase {
+public:
+    /*
+     * Returns the fd to use as the data fd of the named input device, or
+     * -1 to look it up under /dev/input as usual. The events read from it
+     * must be stamped with CLOCK_MONOTONIC.
+     */
+    typedef int (*input_provider_t)(const char* inputName);
+
 protected:
     const char* dev_name;
     const char* data_name;
     int         dev_fd;
     int         data_fd;
 
-    static int openInput(const char* inputName);
+    static input_provider_t sInputProvider;
+
+    // period each consumer of this driver wants, indexed by the handle of
+    // the sensor reading it (physical or virtual), negative when unused
+    int64_t     mDelays[NUM_SENSOR_HANDLES];
+
+    // false when the kernel is too old to stamp events with
+    // CLOCK_MONOTONIC and they come in CLOCK_REALTIME, which is then
+    // moved by mClockOffset (realtime - monotonic)
+    bool        mMonotonicEvents;
+    int64_t     mClockOffset;
+    TimestampFilter mTimestampFilter;
+
+    // programs the hardware, only called while the driver is enabled
+    virtual int programDelay(int64_t ns);
+    int updateDelay();
+
+    static int openInput(const char* inputName, bool* provided);
     static int64_t getTimestamp();
 
 
@@ -42,6 +69,14 @@ protected:
         return t.tv_sec*1000000000LL + t.tv_usec*1000;
     }
 
+    // CLOCK_REALTIME can be stepped at any time, the drivers take the
+    // offset anew each time they fill their reader
+    void updateClockOffset();
+    // time of an input event on the CLOCK_MONOTONIC time base
+    int64_t eventTimestamp(timeval const& t) const {
+        return timevalToNano(t) - mClockOffset;
+    }
+
     int open_device();
     int close_device();
 
@@ -55,8 +90,21 @@ public:
     virtual int readEvents(sensors_event_t* data, int count) = 0;
     virtual bool hasPendingEvents() const;
     virtual int getFd() const;
-    virtual int setDelay(int32_t handle, int64_t ns);
+
+    /*
+     * Records the period a consumer wants, a negative one withdraws it.
+     * The hardware runs at the fastest period asked for, consumers that
+     * want less are decimated by the caller.
+     */
+    int setDelay(int32_t consumer, int64_t ns);
+    int64_t getDelay() const;
+
     virtual int enable(int32_t handle, int enabled) = 0;
+    virtual bool isEnabled() const = 0;
+
+    // lets a test harness stand in for the input devices, drivers created
+    // after this call use it
+    static void setInputProvider(input_provider_t provider);
 };
 
 /*****************************************************************************/
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+
+#include <cutils/atomic.h>
+
+#include "SensorConfig.h"
+
+/*****************************************************************************/
+
+SensorConfig::SensorConfig()
+    : mDirectChannels(0),
+      mDirectRemoved(0),
+      mSeq(0)
+{
+    pthread_mutex_init(&mLock, NULL);
+    mWriter.clients = 0;
+    mWriter.direct = 0;
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+        mWriter.periods[i] = 200000000; // 200 ms by default
+        mWriter.latencies[i] = 0;
+        for (int j=0 ; j<maxDirectChannels ; j++) {
+            mWriter.directRates[j][i] = -1;
+        }
+    }
+    mShared = mWriter;
+}
+
+SensorConfig::~SensorConfig()
+{
+    pthread_mutex_destroy(&mLock);
+}
+
+void SensorConfig::activate(int handle, bool enabled)
+{
+    pthread_mutex_lock(&mLock);
+    if (enabled) {
+        mWriter.clients |= 1<<handle;
+    } else {
+        mWriter.clients &= ~(1<<handle);
+    }
+    publish();
+    pthread_mutex_unlock(&mLock);
+}
+
+void SensorConfig::setPeriod(int handle, int64_t ns)
+{
+    pthread_mutex_lock(&mLock);
+    mWriter.periods[handle] = ns;
+    publish();
+    pthread_mutex_unlock(&mLock);
+}
+
+void SensorConfig::setLatency(int handle, int64_t ns)
+{
+    pthread_mutex_lock(&mLock);
+    mWriter.latencies[handle] = ns;
+    publish();
+    pthread_mutex_unlock(&mLock);
+}
+
+bool SensorConfig::isActivated(int handle)
+{
+    pthread_mutex_lock(&mLock);
+    const bool activated = mWriter.clients & (1<<handle);
+    pthread_mutex_unlock(&mLock);
+    return activated;
+}
+
+int SensorConfig::addDirectChannel()
+{
+    pthread_mutex_lock(&mLock);
+    int index = 0;
+    while (index < maxDirectChannels && (mDirectChannels & (1<<index)))
+        index++;
+    if (index < maxDirectChannels) {
+        mDirectChannels |= 1<<index;
+    } else {
+        index = -ENOSPC;
+    }
+    pthread_mutex_unlock(&mLock);
+    return index;
+}
+
+int SensorConfig::removeDirectChannel(int index)
+{
+    pthread_mutex_lock(&mLock);
+    int err = -EINVAL;
+    if (isDirectChannel(index)) {
+        mDirectRemoved |= 1<<index;
+        for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+            mWriter.directRates[index][i] = -1;
+        }
+        updateDirect();
+        publish();
+        err = 0;
+    }
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+void SensorConfig::releaseDirectChannel(int index)
+{
+    pthread_mutex_lock(&mLock);
+    mDirectChannels &= ~(1<<index);
+    mDirectRemoved &= ~(1<<index);
+    pthread_mutex_unlock(&mLock);
+}
+
+int SensorConfig::setDirectRate(int index, int handle, int64_t ns)
+{
+    pthread_mutex_lock(&mLock);
+    int err = -EINVAL;
+    if (isDirectChannel(index)) {
+        mWriter.directRates[index][handle] = ns < 0 ? -1 : ns;
+        updateDirect();
+        publish();
+        err = 0;
+    }
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+bool SensorConfig::isDirectChannel(int index) const
+{
+    return uint32_t(index) < maxDirectChannels &&
+            ((mDirectChannels & ~mDirectRemoved) & (1<<index));
+}
+
+void SensorConfig::updateDirect()
+{
+    uint32_t direct = 0;
+    for (int i=0 ; i<maxDirectChannels ; i++) {
+        for (int j=0 ; j<NUM_SENSOR_HANDLES ; j++) {
+            if (mWriter.directRates[i][j] >= 0) {
+                direct |= 1<<j;
+            }
+        }
+    }
+    mWriter.direct = direct;
+}
+
+void SensorConfig::publish()
+{
+    // called with mLock held, so mSeq only moves here
+    const int32_t seq = mSeq;
+    android_atomic_release_store(seq + 1, &mSeq);
+    android_memory_barrier();
+    mShared = mWriter;
+    android_atomic_release_store(seq + 2, &mSeq);
+}
+
+bool SensorConfig::read(Snapshot* snapshot, int32_t* seq) const
+{
+    for (;;) {
+        const int32_t before = android_atomic_acquire_load(&mSeq);
+        if (before == *seq)
+            return false;
+        if (before & 1) {
+            // a writer is copying, it's a few hundred bytes
+            sched_yield();
+            continue;
+        }
+        *snapshot = mShared;
+        android_memory_barrier();
+        if (android_atomic_acquire_load(&mSeq) == before) {
+            *seq = before;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_CONFIG_H
+#define ANDROID_SENSOR_CONFIG_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <cutils/atomic.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+/*
+ * What the HAL entry points asked for, published to the poll thread with
+ * a seqlock. The entry points run on binder threads and only serialize
+ * among themselves, the poll thread never takes their lock: it copies
+ * the snapshot and checks the sequence didn't move meanwhile, trying
+ * again in the rare case it raced a writer. The drivers, the fusion and
+ * the batcher are then set up from the copy on the poll thread, which
+ * suspends a driver's DriverThread while it reconfigures that driver.
+ */
+class SensorConfig
+{
+public:
+    enum { maxDirectChannels = 4 };
+
+    struct Snapshot {
+        uint32_t clients;       // handles activated by clients
+        uint32_t direct;        // handles read by a direct channel
+        int64_t periods[NUM_SENSOR_HANDLES];    // ns, as last set
+        int64_t latencies[NUM_SENSOR_HANDLES];  // ns, max report latency
+        // by channel - 1, ns or -1 when the channel doesn't read the handle
+        int64_t directRates[maxDirectChannels][NUM_SENSOR_HANDLES];
+    };
+
+            SensorConfig();
+            ~SensorConfig();
+
+    // any thread
+    void activate(int handle, bool enabled);
+    void setPeriod(int handle, int64_t ns);
+    void setLatency(int handle, int64_t ns);
+    bool isActivated(int handle);
+
+    // direct channel slots, addDirectChannel() returns a free index or
+    // -ENOSPC, the others -EINVAL when the index isn't registered. A
+    // removed slot keeps its index until released, so that nothing
+    // registered in the meantime gets it.
+    int addDirectChannel();
+    int removeDirectChannel(int index);
+    void releaseDirectChannel(int index);
+    int setDirectRate(int index, int handle, int64_t ns);
+
+    // poll thread only, true with a copy in *snapshot and its sequence
+    // in *seq when something was published since *seq
+    bool read(Snapshot* snapshot, int32_t* seq) const;
+    bool hasChanged(int32_t seq) const {
+        return android_atomic_acquire_load(&mSeq) != seq;
+    }
+
+private:
+    pthread_mutex_t mLock;      // between writers
+    Snapshot mWriter;           // the writers' copy, under mLock
+    uint32_t mDirectChannels;   // slots in use, under mLock
+    uint32_t mDirectRemoved;    // and those of them being released
+    volatile int32_t mSeq;      // odd while mShared is being written
+    Snapshot mShared;
+
+    void publish();
+    void updateDirect();
+    bool isDirectChannel(int index) const;
+};
+
+/*****************************************************************************/
+
+/*
+ * Decimation on a fixed grid: true if an event at timestamp is due for a
+ * consumer that wants one every period, next being when its next one is
+ * due. A quarter of a period of slack absorbs the jitter when the sensor
+ * runs at the requested rate; keeping the grid fixed makes the average
+ * rate match when it runs faster. Used for the clients of each handle on
+ * the poll path and for each direct channel.
+ */
+static inline bool isDueOnGrid(int64_t timestamp, int64_t period, int64_t* next)
+{
+    if (period <= 0)
+        return true;
+    if (timestamp < *next - period/4)
+        return false;
+    *next = (timestamp >= *next + period) ? timestamp + period : *next + period;
+    return true;
+}
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_CONFIG_H
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2010 Motorola, Inc.
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "SensorFusion.h"
+
+/*****************************************************************************/
+
+// correction gains towards the accelerometer and magnetometer references
+#define KP_ACCEL        (2.0f)
+#define KP_MAG          (1.0f)
+#define KI              (0.005f)
+
+// accelerometer samples further than this from 1g are mostly motion
+#define ACCEL_TRUST     (0.2f * GRAVITY_EARTH)
+// the earth's field is 25 to 65 uT, anything else is disturbed
+#define MAG_MIN         (10.0f)
+#define MAG_MAX         (100.0f)
+
+#define MAX_DT          (0.1f)
+
+static inline vec4_t splat(float s) {
+    vec4_t v = { s, s, s, s };
+    return v;
+}
+
+static inline void cross(const float* a, const float* b, float* r) {
+    r[0] = a[1]*b[2] - a[2]*b[1];
+    r[1] = a[2]*b[0] - a[0]*b[2];
+    r[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+static inline float normalize3(float* v) {
+    float n = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    if (n > 0) {
+        v[0] /= n;
+        v[1] /= n;
+        v[2] /= n;
+    }
+    return n;
+}
+
+SensorFusion::SensorFusion()
+    : mSeaLevel(PRESSURE_SEA_LEVEL)
+{
+    reset();
+}
+
+void SensorFusion::reset()
+{
+    mQ.v = splat(0);
+    mQ.f[0] = 1;
+    memset(mBias, 0, sizeof(mBias));
+    mMagStatus = SENSOR_STATUS_ACCURACY_HIGH;
+    mHasAccel = false;
+    mHasMag = false;
+    mInitialized = false;
+    mLastGyroTime = 0;
+}
+
+void SensorFusion::setSeaLevelPressure(float hPa)
+{
+    mSeaLevel = hPa;
+}
+
+uint32_t SensorFusion::inputsOf(uint32_t enabledMask)
+{
+    uint32_t inputs = 0;
+    if (enabledMask & (1<<ID_O))
+        inputs |= (1<<ID_A) | (1<<ID_M);
+    if (enabledMask & (1<<ID_RV))
+        inputs |= (1<<ID_A) | (1<<ID_M) | (1<<ID_G);
+    if (enabledMask & ((1<<ID_GR) | (1<<ID_LA)))
+        inputs |= (1<<ID_A) | (1<<ID_G);
+    if (enabledMask & (1<<ID_AL))
+        inputs |= (1<<ID_B);
+    return inputs;
+}
+
+void SensorFusion::initialize()
+{
+    // same construction as SensorManager.getRotationMatrix(): the rows
+    // of the device to world rotation are east, north and up
+    float up[3] = { mAccel[0], mAccel[1], mAccel[2] };
+    float ref[3] = { 0, 1, 0 };
+    if (mHasMag) {
+        memcpy(ref, mMag, sizeof(ref));
+    } else if (fabsf(up[1]) > 0.9f * sqrtf(up[0]*up[0] + up[1]*up[1] + up[2]*up[2])) {
+        ref[1] = 0;
+        ref[2] = 1;
+    }
+    float east[3], north[3];
+    cross(ref, up, east);
+    if (normalize3(east) == 0 || normalize3(up) == 0)
+        return;
+    cross(up, east, north);
+
+    const float r00 = east[0],  r01 = east[1],  r02 = east[2];
+    const float r10 = north[0], r11 = north[1], r12 = north[2];
+    const float r20 = up[0],    r21 = up[1],    r22 = up[2];
+    const float trace = r00 + r11 + r22;
+    float w, x, y, z;
+    if (trace > 0) {
+        float s = 0.5f / sqrtf(trace + 1.0f);
+        w = 0.25f / s;
+        x = (r21 - r12) * s;
+        y = (r02 - r20) * s;
+        z = (r10 - r01) * s;
+    } else if (r00 > r11 && r00 > r22) {
+        float s = 2.0f * sqrtf(1.0f + r00 - r11 - r22);
+        w = (r21 - r12) / s;
+        x = 0.25f * s;
+        y = (r01 + r10) / s;
+        z = (r02 + r20) / s;
+    } else if (r11 > r22) {
+        float s = 2.0f * sqrtf(1.0f + r11 - r00 - r22);
+        w = (r02 - r20) / s;
+        x = (r01 + r10) / s;
+        y = 0.25f * s;
+        z = (r12 + r21) / s;
+    } else {
+        float s = 2.0f * sqrtf(1.0f + r22 - r00 - r11);
+        w = (r10 - r01) / s;
+        x = (r02 + r20) / s;
+        y = (r12 + r21) / s;
+        z = 0.25f * s;
+    }
+    mQ.f[0] = w;
+    mQ.f[1] = x;
+    mQ.f[2] = y;
+    mQ.f[3] = z;
+    mInitialized = true;
+}
+
+void SensorFusion::gravity(float* g) const
+{
+    // world up expressed in the device frame, third row of the rotation
+    const float w = mQ.f[0], x = mQ.f[1], y = mQ.f[2], z = mQ.f[3];
+    g[0] = 2.0f * (x*z - w*y);
+    g[1] = 2.0f * (y*z + w*x);
+    g[2] = w*w - x*x - y*y + z*z;
+}
+
+void SensorFusion::update(const float* gyro, float dt)
+{
+    const float w = mQ.f[0], x = mQ.f[1], y = mQ.f[2], z = mQ.f[3];
+    float error[3] = { 0, 0, 0 };
+
+    float a[3] = { mAccel[0], mAccel[1], mAccel[2] };
+    const float an = normalize3(a);
+    if (mHasAccel && fabsf(an - GRAVITY_EARTH) < ACCEL_TRUST) {
+        float v[3], e[3];
+        gravity(v);
+        cross(a, v, e);
+        error[0] += KP_ACCEL * e[0];
+        error[1] += KP_ACCEL * e[1];
+        error[2] += KP_ACCEL * e[2];
+    }
+
+    float m[3] = { mMag[0], mMag[1], mMag[2] };
+    const float mn = normalize3(m);
+    if (mHasMag && mn > MAG_MIN && mn < MAG_MAX) {
+        // field in the world frame, flattened onto north and up
+        const float hx = 2.0f*(m[0]*(0.5f - y*y - z*z) + m[1]*(x*y - w*z) + m[2]*(x*z + w*y));
+        const float hy = 2.0f*(m[0]*(x*y + w*z) + m[1]*(0.5f - x*x - z*z) + m[2]*(y*z - w*x));
+        const float hz = 2.0f*(m[0]*(x*z - w*y) + m[1]*(y*z + w*x) + m[2]*(0.5f - x*x - y*y));
+        const float bn = sqrtf(hx*hx + hy*hy);
+        const float bz = hz;
+        // and back into the device frame
+        float b[3], e[3];
+        b[0] = 2.0f*(bn*(x*y + w*z) + bz*(x*z - w*y));
+        b[1] = 2.0f*(bn*(0.5f - x*x - z*z) + bz*(y*z + w*x));
+        b[2] = 2.0f*(bn*(y*z - w*x) + bz*(0.5f - x*x - y*y));
+        cross(m, b, e);
+        error[0] += KP_MAG * e[0];
+        error[1] += KP_MAG * e[1];
+        error[2] += KP_MAG * e[2];
+    }
+
+    float g[3];
+    for (int i=0 ; i<3 ; i++) {
+        mBias[i] += KI * error[i] * dt;
+        g[i] = gyro[i] + error[i] + mBias[i];
+    }
+
+    // q' = q + dt/2 * q * (0, g), as four packed multiply-adds
+    const vec4_t gw = { 0,     g[0],  g[1],  g[2] };
+    const vec4_t gx = { -g[0], 0,    -g[2],  g[1] };
+    const vec4_t gy = { -g[1], g[2],  0,    -g[0] };
+    const vec4_t gz = { -g[2], -g[1], g[0],  0    };
+    const vec4_t dq = splat(w)*gw + splat(x)*gx + splat(y)*gy + splat(z)*gz;
+    mQ.v += dq * splat(0.5f * dt);
+
+    quat_t sq;
+    sq.v = mQ.v * mQ.v;
+    const float norm = sqrtf(sq.f[0] + sq.f[1] + sq.f[2] + sq.f[3]);
+    if (norm > 0) {
+        mQ.v *= splat(1.0f / norm);
+    } else {
+        reset();
+    }
+}
+
+int SensorFusion::orientation(int64_t timestamp, sensors_event_t* out) const
+{
+    // tilt compensated compass, the field is projected on the plane
+    // orthogonal to gravity the same way initialize() does it
+    float up[3] = { mAccel[0], mAccel[1], mAccel[2] };
+    float east[3], north[3];
+    cross(mMag, up, east);
+    if (normalize3(east) == 0 || normalize3(up) == 0)
+        return 0;
+    cross(up, east, north);
+
+    const float rad2deg = float(180 / M_PI);
+    float azimuth = atan2f(east[1], north[1]) * rad2deg;
+    if (azimuth < 0)
+        azimuth += 360.0f;
+
+    memset(out, 0, sizeof(*out));
+    out->version = sizeof(sensors_event_t);
+    out->sensor = ID_O;
+    out->type = SENSOR_TYPE_ORIENTATION;
+    out->timestamp = timestamp;
+    // the legacy conventions: pitch spans a full turn, roll is positive
+    // when the x axis goes up
+    out->orientation.azimuth = azimuth;
+    out->orientation.pitch = atan2f(-up[1], up[2]) * rad2deg;
+    out->orientation.roll = asinf(up[0]) * rad2deg;
+    // the heading is only as good as the compass calibration
+    out->orientation.status = mMagStatus;
+    return 1;
+}
+
+int SensorFusion::altitude(sensors_event_t const& event,
+        sensors_event_t* out) const
+{
+    memset(out, 0, sizeof(*out));
+    out->version = sizeof(sensors_event_t);
+    out->sensor = ID_AL;
+    out->type = SENSOR_TYPE_ALTITUDE;
+    out->timestamp = event.timestamp;
+    // international standard atmosphere, good to a few meters below 11 km
+    out->data[0] = 44330.0f * (1.0f - powf(event.pressure / mSeaLevel, 1/5.255f));
+    return 1;
+}
+
+int SensorFusion::report(int64_t timestamp, sensors_event_t* out, int count,
+        uint32_t enabledMask) const
+{
+    int numEvents = 0;
+    float g[3];
+    gravity(g);
+
+    if ((enabledMask & (1<<ID_RV)) && numEvents < count) {
+        sensors_event_t* ev = &out[numEvents++];
+        memset(ev, 0, sizeof(*ev));
+        ev->version = sizeof(sensors_event_t);
+        ev->sensor = ID_RV;
+        ev->type = SENSOR_TYPE_ROTATION_VECTOR;
+        ev->timestamp = timestamp;
+        // the rotation vector only carries x, y, z with w >= 0
+        const float sign = mQ.f[0] < 0 ? -1.0f : 1.0f;
+        ev->data[0] = sign * mQ.f[1];
+        ev->data[1] = sign * mQ.f[2];
+        ev->data[2] = sign * mQ.f[3];
+        ev->data[3] = sign * mQ.f[0];
+    }
+    if ((enabledMask & (1<<ID_GR)) && numEvents < count) {
+        sensors_event_t* ev = &out[numEvents++];
+        memset(ev, 0, sizeof(*ev));
+        ev->version = sizeof(sensors_event_t);
+        ev->sensor = ID_GR;
+        ev->type = SENSOR_TYPE_GRAVITY;
+        ev->timestamp = timestamp;
+        ev->acceleration.x = g[0] * GRAVITY_EARTH;
+        ev->acceleration.y = g[1] * GRAVITY_EARTH;
+        ev->acceleration.z = g[2] * GRAVITY_EARTH;
+        ev->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+    }
+    if ((enabledMask & (1<<ID_LA)) && numEvents < count) {
+        sensors_event_t* ev = &out[numEvents++];
+        memset(ev, 0, sizeof(*ev));
+        ev->version = sizeof(sensors_event_t);
+        ev->sensor = ID_LA;
+        ev->type = SENSOR_TYPE_LINEAR_ACCELERATION;
+        ev->timestamp = timestamp;
+        ev->acceleration.x = mAccel[0] - g[0] * GRAVITY_EARTH;
+        ev->acceleration.y = mAccel[1] - g[1] * GRAVITY_EARTH;
+        ev->acceleration.z = mAccel[2] - g[2] * GRAVITY_EARTH;
+        ev->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+    }
+    return numEvents;
+}
+
+int SensorFusion::process(sensors_event_t const& event, sensors_event_t* out,
+        int count, uint32_t enabledMask)
+{
+    switch (event.sensor) {
+        case ID_A:
+            memcpy(mAccel, event.acceleration.v, sizeof(mAccel));
+            mHasAccel = true;
+            return 0;
+        case ID_M:
+            memcpy(mMag, event.magnetic.v, sizeof(mMag));
+            mMagStatus = event.magnetic.status;
+            mHasMag = true;
+            if ((enabledMask & (1<<ID_O)) && count > 0 && mHasAccel)
+                return orientation(event.timestamp, out);
+            return 0;
+        case ID_B:
+            if ((enabledMask & (1<<ID_AL)) && count > 0 && mSeaLevel > 0)
+                return altitude(event, out);
+            return 0;
+        case ID_G:
+            break;
+        default:
+            return 0;
+    }
+
+    if (!mInitialized) {
+        mLastGyroTime = event.timestamp;
+        if (mHasAccel)
+            initialize();
+        return 0;
+    }
+
+    float dt = (event.timestamp - mLastGyroTime) * 1e-9f;
+    mLastGyroTime = event.timestamp;
+    if (dt <= 0 || dt > MAX_DT) {
+        // first sample after a gap, don't integrate across it
+        return 0;
+    }
+    update(event.gyro.v, dt);
+    return report(event.timestamp, out, count, enabledMask);
+}
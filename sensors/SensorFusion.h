@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2010 Motorola, Inc.
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_FUSION_H
+#define ANDROID_SENSOR_FUSION_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+// four packed floats, NEON on the device and SSE on the host
+typedef float vec4_t __attribute__((vector_size(16)));
+
+/*
+ * Attitude filter behind the rotation vector, gravity and linear
+ * acceleration sensors. The orientation is a quaternion integrated from
+ * the gyroscope on each of its samples, with a proportional-integral
+ * correction pulling it towards the gravity direction seen by the
+ * accelerometer and the north seen by the magnetometer.
+ *
+ * The altitude sensor is computed here too, from the barometer.
+ */
+class SensorFusion
+{
+public:
+            SensorFusion();
+
+    void reset();
+    void setSeaLevelPressure(float hPa);
+
+    // feeds a physical sensor event, writes the virtual sensor events it
+    // produces for the handles in enabledMask, returns how many
+    int process(sensors_event_t const& event, sensors_event_t* out,
+            int count, uint32_t enabledMask);
+
+    // physical sensors the virtual ones in enabledMask depend on
+    static uint32_t inputsOf(uint32_t enabledMask);
+
+private:
+    union quat_t {
+        vec4_t v;
+        float f[4];     // w, x, y, z
+    };
+
+    quat_t mQ;
+    float mBias[3];     // integral term of the correction, rad/s
+    float mAccel[3];
+    float mMag[3];
+    int8_t mMagStatus;
+    bool mHasAccel;
+    bool mHasMag;
+    bool mInitialized;
+    int64_t mLastGyroTime;
+    float mSeaLevel;    // hPa
+
+    void initialize();
+    void update(const float* gyro, float dt);
+    void gravity(float* g) const;
+    int orientation(int64_t timestamp, sensors_event_t* out) const;
+    int altitude(sensors_event_t const& event, sensors_event_t* out) const;
+    int report(int64_t timestamp, sensors_event_t* out, int count,
+            uint32_t enabledMask) const;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_FUSION_H
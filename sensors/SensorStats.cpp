@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "SensorStats.h"
+
+/*****************************************************************************/
+
+SensorStats::Counters SensorStats::sCounters[numHandles];
+
+static int64_t clockNow(clockid_t clock) {
+    struct timespec t;
+    t.tv_sec = t.tv_nsec = 0;
+    clock_gettime(clock, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+void SensorStats::eventRead(int handle, int count) {
+    if (uint32_t(handle) < numHandles)
+        android_atomic_add(count, &sCounters[handle].read);
+}
+
+void SensorStats::eventDropped(int handle, int count) {
+    if (uint32_t(handle) < numHandles)
+        android_atomic_add(count, &sCounters[handle].dropped);
+}
+
+void SensorStats::fillError(int handle) {
+    if (uint32_t(handle) < numHandles)
+        android_atomic_inc(&sCounters[handle].fillErrors);
+}
+
+void SensorStats::inputOverrun(int handle) {
+    if (uint32_t(handle) < numHandles)
+        android_atomic_inc(&sCounters[handle].overruns);
+}
+
+int SensorStats::bucketOf(int64_t ns) {
+    int64_t us = ns / 1000;
+    if (us < 1)
+        return 0;
+    int bucket = 1;
+    while (us > 1 && bucket < numBuckets - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void SensorStats::eventsDelivered(sensors_event_t* data, int count) {
+    if (count <= 0)
+        return;
+
+    // the drivers put every event on the monotonic clock
+    const int64_t now = clockNow(CLOCK_MONOTONIC);
+
+    for (int i=0 ; i<count ; i++) {
+        sensors_event_t* event = &data[i];
+        int64_t t = int64_t(uint64_t(event->reserved1[3]) << 32 |
+                event->reserved1[2]);
+        if (!t) {
+            t = event->timestamp;
+        }
+
+        // the exit time travels with the event in reserved1[0..1]
+        event->reserved1[0] = uint32_t(now);
+        event->reserved1[1] = uint32_t(uint64_t(now) >> 32);
+        event->reserved1[2] = 0;
+        event->reserved1[3] = 0;
+
+        if (uint32_t(event->sensor) < numHandles) {
+            android_atomic_inc(
+                    &sCounters[event->sensor].latency[bucketOf(now - t)]);
+        }
+    }
+}
+
+int64_t SensorStats::percentile(Counters const& c, int32_t total, int percent) {
+    int64_t wanted = (int64_t(total) * percent + 99) / 100;
+    int64_t seen = 0;
+    for (int b=0 ; b<numBuckets ; b++) {
+        seen += c.latency[b];
+        if (seen >= wanted) {
+            // upper bound of the bucket in us
+            return b ? (1LL << (b - 1)) * 2 : 1;
+        }
+    }
+    return -1;
+}
+
+int SensorStats::dump(char* buffer, size_t size) {
+    if (!size)
+        return 0;
+
+    size_t length = 0;
+    for (int h=0 ; h<numHandles && length<size ; h++) {
+        Counters const& c = sCounters[h];
+        int32_t delivered = 0;
+        for (int b=0 ; b<numBuckets ; b++) {
+            delivered += c.latency[b];
+        }
+        if (!c.read && !delivered && !c.fillErrors && !c.overruns)
+            continue;
+
+        length += snprintf(buffer + length, size - length,
+                "sensor %d: read %d, dropped %d, fill errors %d, overruns %d, "
+                "delivered %d, latency p50 <= %lldus, p99 <= %lldus\n",
+                h, c.read, c.dropped, c.fillErrors, c.overruns, delivered,
+                (long long)(delivered ? percentile(c, delivered, 50) : 0),
+                (long long)(delivered ? percentile(c, delivered, 99) : 0));
+        for (int b=0 ; b<numBuckets && length<size ; b++) {
+            if (!c.latency[b])
+                continue;
+            length += snprintf(buffer + length, size - length,
+                    "    < %8lldus: %d\n",
+                    b ? (1LL << (b - 1)) * 2 : 1LL, c.latency[b]);
+        }
+    }
+    return length < size ? length : size - 1;
+}
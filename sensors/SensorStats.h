@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_STATS_H
+#define ANDROID_SENSOR_STATS_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+/*
+ * Per-sensor counters and a histogram of the time between the kernel
+ * timestamp of an event and the moment it leaves pollEvents(). The kernel
+ * time is the one before the TimestampFilter smoothing, the drivers that
+ * smooth keep it with the event through setKernelTime(). Buckets
+ * are powers of two in microseconds. Everything is updated with atomic
+ * increments, so dump() can run on any thread without a lock.
+ */
+class SensorStats
+{
+public:
+    enum {
+        numHandles  = NUM_SENSOR_HANDLES,
+        numBuckets  = 24,       // up to ~8s
+    };
+
+    static void eventRead(int handle, int count = 1);
+    static void eventDropped(int handle, int count = 1);
+    static void fillError(int handle);
+    // evdev lost events of the sensor, see SYN_DROPPED
+    static void inputOverrun(int handle);
+
+    // stamps the exit time in each event and records its latency
+    static void eventsDelivered(sensors_event_t* data, int count);
+
+    // the event's time as read from the input device, when its timestamp
+    // was smoothed; it rides in reserved1[2..3] until the event is
+    // delivered
+    static void setKernelTime(sensors_event_t* event, int64_t time) {
+        event->reserved1[2] = uint32_t(time);
+        event->reserved1[3] = uint32_t(uint64_t(time) >> 32);
+    }
+
+    // writes a summary to buffer, returns its length
+    static int dump(char* buffer, size_t size);
+
+private:
+    struct Counters {
+        volatile int32_t read;
+        volatile int32_t dropped;
+        volatile int32_t fillErrors;
+        volatile int32_t overruns;
+        volatile int32_t latency[numBuckets];
+    };
+
+    static Counters sCounters[numHandles];
+
+    static int bucketOf(int64_t ns);
+    static int64_t percentile(Counters const& c, int32_t total, int percent);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_STATS_H
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include "TimestampFilter.h"
+
+/*****************************************************************************/
+
+// weight of the past at each sample, about 64 samples of memory
+#define FORGET          (1.0 - 1.0/64)
+// samples needed before the fit is trusted
+#define MIN_SAMPLES     8
+// a gap longer than this many periods restarts the fit
+#define MAX_GAP         16
+// and so does a sample closer to the previous one than this fraction
+#define MIN_STEP        0.25
+
+TimestampFilter::TimestampFilter()
+    : mLastFiltered(0)
+{
+    reset();
+}
+
+void TimestampFilter::reset()
+{
+    mS0 = mS1 = mS2 = 0;
+    mT0 = mT1 = 0;
+    mPeriod = 0;
+    mLastRaw = 0;
+    mCount = 0;
+}
+
+int64_t TimestampFilter::period() const
+{
+    return mCount >= MIN_SAMPLES ? int64_t(mPeriod) : 0;
+}
+
+int64_t TimestampFilter::filter(int64_t timestamp)
+{
+    const double dt = double(timestamp - mLastRaw);
+    double steps = 1;
+    if (mCount && mPeriod > 0) {
+        steps = floor(dt / mPeriod + 0.5);
+        if (steps > MAX_GAP || dt < MIN_STEP * mPeriod) {
+            // the sensor was off, or changed rate
+            reset();
+        } else if (steps < 1) {
+            steps = 1;
+        }
+    } else if (mCount && dt <= 0) {
+        reset();
+    }
+
+    if (mCount) {
+        // age the sums and move their origin to the new sample, which is
+        // steps further in index and dt further in time
+        mS0 *= FORGET;
+        mS1 *= FORGET;
+        mS2 *= FORGET;
+        mT0 *= FORGET;
+        mT1 *= FORGET;
+        mS2 += steps * (steps * mS0 - 2 * mS1);
+        mT1 -= steps * mT0;
+        mS1 -= steps * mS0;
+        mT1 -= dt * mS1;
+        mT0 -= dt * mS0;
+        if (mCount == 1) {
+            // all we know about the period so far
+            mPeriod = dt;
+        }
+    }
+    mS0 += 1;
+    mLastRaw = timestamp;
+    mCount++;
+
+    int64_t filtered = timestamp;
+    const double det = mS0 * mS2 - mS1 * mS1;
+    if (mCount >= 2 && det > 0) {
+        const double slope = (mS0 * mT1 - mS1 * mT0) / det;
+        if (slope > 0) {
+            mPeriod = slope;
+        }
+        if (mCount >= MIN_SAMPLES) {
+            // the line at the origin is the correction for this sample
+            const double offset = (mT0 - slope * mS1) / mS0;
+            filtered = timestamp + int64_t(offset);
+        }
+    }
+
+    // never go back in time, even across a reset
+    if (filtered <= mLastFiltered) {
+        filtered = mLastFiltered + 1;
+    }
+    mLastFiltered = filtered;
+    return filtered;
+}
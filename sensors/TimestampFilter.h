@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_TIMESTAMP_FILTER_H
+#define ANDROID_TIMESTAMP_FILTER_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Smooths the timestamps of a sensor sampling at a fixed rate. The kernel
+ * stamps each sample when its interrupt gets serviced, which adds a random
+ * delay; fitting sample index against time with an exponentially weighted
+ * running linear regression recovers the sample clock, and the fitted line
+ * is used instead of the raw times. Dropped samples are accounted for by
+ * rounding the gap to a number of periods.
+ */
+class TimestampFilter
+{
+public:
+            TimestampFilter();
+
+    void reset();
+
+    // takes the raw time of a sample, returns the filtered one
+    int64_t filter(int64_t timestamp);
+
+    // current estimate of the sample period, 0 until there is one
+    int64_t period() const;
+
+private:
+    // the sums are kept relative to the last sample, so they stay small
+    double mS0;     // sum of weights
+    double mS1;     // sum of weighted indices
+    double mS2;     // sum of weighted squared indices
+    double mT0;     // sum of weighted times
+    double mT1;     // sum of weighted index * time
+    double mPeriod;
+    int64_t mLastRaw;
+    int64_t mLastFiltered;
+    int mCount;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_TIMESTAMP_FILTER_H
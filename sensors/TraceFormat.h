@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_TRACE_FORMAT_H
+#define ANDROID_TRACE_FORMAT_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * The input traces of InputTrace, written by TraceWriter and read back by
+ * TraceReader. Everything is little endian.
+ *
+ * A trace is a trace_header_t followed by records, each starting with a
+ * trace_record_t and holding size bytes:
+ *
+ *  DEVICE  the name of the input device behind an id
+ *  BLOCK   a trace_block_t then count events of one device, encoded
+ *  INDEX   a trace_index_t for each record before it
+ *
+ * and, when the trace was closed cleanly, a trace_trailer_t pointing at
+ * the INDEX record. Without it the records can still be walked since each
+ * gives its size.
+ *
+ * The events in a block are three numbers each:
+ *
+ *  zigzag(time - time of the previous event), in us
+ *  code << 5 | type
+ *  zigzag(value - previous value of the same code and type)
+ *
+ * written as varints, 7 bits a byte from the lowest with the top bit set
+ * when more follow. The previous time starts at the first of the block and
+ * the previous values at 0, so that each block decodes on its own. A frame
+ * of three axes and its EV_SYN takes around 16 bytes, down from 64 or 96.
+ */
+
+#define TRACE_MAGIC         (0x52544e53)    // 'SNTR'
+#define TRACE_VERSION       (2)
+
+enum {
+    TRACE_DEVICE    = 1,
+    TRACE_BLOCK     = 2,
+    TRACE_INDEX     = 3,
+};
+
+struct trace_header_t {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct trace_record_t {
+    uint8_t kind;
+    uint8_t device;
+    uint16_t count;     // events in a block
+    uint32_t size;      // bytes following
+};
+
+struct trace_block_t {
+    int64_t first;      // us, time of the first event
+    int64_t last;       // us, time of the last event
+};
+
+struct trace_index_t {
+    uint32_t offset;    // of the record in the file
+    uint8_t kind;
+    uint8_t device;
+    uint16_t count;
+    int64_t first;      // blocks only
+    int64_t last;
+};
+
+struct trace_trailer_t {
+    uint32_t index;     // offset of the INDEX record
+    uint32_t magic;
+};
+
+/*
+ * The varint coding of the events. The previous values are kept in a small
+ * table hashed by code and type, a collision only costs a few bytes.
+ */
+struct TraceCodec {
+    enum {
+        numPredictors   = 64,
+        maxEventSize    = 10 + 3 + 5,   // bytes
+    };
+
+    static size_t slot(uint16_t type, uint16_t code) {
+        return ((type << 4) ^ code) & (numPredictors - 1);
+    }
+
+    static uint64_t zigzag(int64_t v) {
+        return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t v) {
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+
+    static uint8_t* put(uint8_t* p, uint64_t v) {
+        while (v >= 0x80) {
+            *p++ = uint8_t(v) | 0x80;
+            v >>= 7;
+        }
+        *p++ = uint8_t(v);
+        return p;
+    }
+
+    // returns NULL if the varint runs past end
+    static uint8_t const* get(uint8_t const* p, uint8_t const* end,
+            uint64_t* v) {
+        uint64_t r = 0;
+        for (int shift=0 ; p<end && shift<64 ; shift+=7) {
+            const uint8_t b = *p++;
+            r |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                *v = r;
+                return p;
+            }
+        }
+        return NULL;
+    }
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_TRACE_FORMAT_H
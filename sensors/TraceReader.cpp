@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/input.h>
+
+#include <cutils/log.h>
+
+#include "TraceReader.h"
+
+/*****************************************************************************/
+
+TraceReader::TraceReader()
+    : mData(NULL),
+      mSize(0),
+      mNumDevices(0),
+      mStart(0),
+      mEnd(0)
+{
+    memset(mNames, 0, sizeof(mNames));
+    memset(mCursors, 0, sizeof(mCursors));
+}
+
+TraceReader::~TraceReader()
+{
+    for (size_t i=0 ; i<maxDevices ; i++) {
+        free(mCursors[i].blocks);
+    }
+    if (mData) {
+        munmap((void*)mData, mSize);
+    }
+}
+
+int TraceReader::open(const char* path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size >= off_t(sizeof(trace_header_t))) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return -EINVAL;
+    mData = (uint8_t const*)data;
+    mSize = st.st_size;
+
+    trace_header_t header;
+    memcpy(&header, mData, sizeof(header));
+    if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        LOGE("%s isn't an input trace of version %d", path, TRACE_VERSION);
+        return -EINVAL;
+    }
+
+    trace_index_t* index;
+    size_t size;
+    int err = loadIndex(&index, &size);
+    if (err)
+        return err;
+
+    // the blocks of each device, in time order as they were written
+    size_t counts[maxDevices];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i=0 ; i<size ; i++) {
+        trace_index_t const& entry = index[i];
+        if (entry.device >= maxDevices)
+            continue;
+        if (entry.kind == TRACE_DEVICE) {
+            trace_record_t record;
+            memcpy(&record, mData + entry.offset, sizeof(record));
+            const size_t length = record.size < sizeof(mNames[0]) ?
+                    record.size : sizeof(mNames[0]) - 1;
+            memcpy(mNames[entry.device], mData + entry.offset +
+                    sizeof(record), length);
+            mNames[entry.device][length] = 0;
+            if (entry.device >= mNumDevices)
+                mNumDevices = entry.device + 1;
+        } else if (entry.kind == TRACE_BLOCK && entry.count) {
+            counts[entry.device]++;
+        }
+    }
+    for (size_t d=0 ; d<mNumDevices ; d++) {
+        Cursor& c = mCursors[d];
+        c.blocks = (trace_index_t*)malloc((counts[d] + 1) *
+                sizeof(trace_index_t));
+        if (!c.blocks) {
+            free(index);
+            return -ENOMEM;
+        }
+    }
+    bool first = true;
+    for (size_t i=0 ; i<size ; i++) {
+        trace_index_t const& entry = index[i];
+        if (entry.kind != TRACE_BLOCK || !entry.count ||
+                entry.device >= mNumDevices)
+            continue;
+        Cursor& c = mCursors[entry.device];
+        c.blocks[c.numBlocks++] = entry;
+        if (first || entry.first < mStart)
+            mStart = entry.first;
+        if (first || entry.last > mEnd)
+            mEnd = entry.last;
+        first = false;
+    }
+    free(index);
+
+    seek(mStart);
+    return 0;
+}
+
+int TraceReader::loadIndex(trace_index_t** index, size_t* size)
+{
+    // the index of a trace closed cleanly
+    trace_trailer_t trailer;
+    trace_record_t record;
+    if (mSize >= sizeof(trace_header_t) + sizeof(record) + sizeof(trailer)) {
+        memcpy(&trailer, mData + mSize - sizeof(trailer), sizeof(trailer));
+        if (trailer.magic == TRACE_MAGIC &&
+                trailer.index >= sizeof(trace_header_t) &&
+                trailer.index + sizeof(record) <= mSize - sizeof(trailer)) {
+            memcpy(&record, mData + trailer.index, sizeof(record));
+            const size_t n = record.size / sizeof(trace_index_t);
+            if (record.kind == TRACE_INDEX && record.size ==
+                    mSize - sizeof(trailer) - trailer.index - sizeof(record)) {
+                *index = (trace_index_t*)malloc((n + 1) * sizeof(trace_index_t));
+                if (!*index)
+                    return -ENOMEM;
+                memcpy(*index, mData + trailer.index + sizeof(record),
+                        n * sizeof(trace_index_t));
+                *size = n;
+                // the offsets come from the file, check them like the walk does
+                for (size_t i=0 ; i<n ; i++) {
+                    if ((*index)[i].offset + sizeof(record) > trailer.index) {
+                        *size = i;
+                        break;
+                    }
+                    memcpy(&record, mData + (*index)[i].offset, sizeof(record));
+                    if ((*index)[i].offset + sizeof(record) + record.size >
+                            trailer.index) {
+                        *size = i;
+                        break;
+                    }
+                }
+                return 0;
+            }
+        }
+    }
+
+    // otherwise the records are walked, up to one cut short
+    LOGW("input trace without an index, walking it");
+    size_t capacity = 256;
+    *index = (trace_index_t*)malloc(capacity * sizeof(trace_index_t));
+    *size = 0;
+    size_t pos = sizeof(trace_header_t);
+    while (*index && pos + sizeof(record) <= mSize) {
+        memcpy(&record, mData + pos, sizeof(record));
+        if (record.size > mSize - pos - sizeof(record))
+            break;
+        if (*size == capacity) {
+            capacity *= 2;
+            trace_index_t* grown = (trace_index_t*)realloc(*index,
+                    capacity * sizeof(trace_index_t));
+            if (!grown)
+                break;
+            *index = grown;
+        }
+        trace_index_t& entry = (*index)[(*size)++];
+        entry.offset = pos;
+        entry.kind = record.kind;
+        entry.device = record.device;
+        entry.count = record.count;
+        entry.first = entry.last = 0;
+        if (record.kind == TRACE_BLOCK && record.size >= sizeof(trace_block_t)) {
+            trace_block_t block;
+            memcpy(&block, mData + pos + sizeof(record), sizeof(block));
+            entry.first = block.first;
+            entry.last = block.last;
+        }
+        pos += sizeof(record) + record.size;
+    }
+    return *index ? 0 : -ENOMEM;
+}
+
+const char* TraceReader::getDeviceName(size_t device) const
+{
+    return device < mNumDevices ? mNames[device] : NULL;
+}
+
+void TraceReader::seek(int64_t time)
+{
+    for (size_t d=0 ; d<mNumDevices ; d++) {
+        Cursor* c = &mCursors[d];
+        // the first block still going at time
+        size_t lo = 0, hi = c->numBlocks;
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            if (c->blocks[mid].last < time) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        // blocks are cut anywhere, whether the first event of this one
+        // starts a frame is only known from the end of the one before
+        c->block = lo ? lo - 1 : 0;
+        c->pending = startBlock(c);
+        bool frameStart = true;
+        while (c->pending && (c->time < time || !frameStart)) {
+            frameStart = c->type == EV_SYN;
+            c->pending = decode(c);
+        }
+    }
+}
+
+bool TraceReader::startBlock(Cursor* c)
+{
+    for ( ; c->block < c->numBlocks ; c->block++) {
+        trace_index_t const& entry = c->blocks[c->block];
+        trace_record_t record;
+        memcpy(&record, mData + entry.offset, sizeof(record));
+        if (record.kind != TRACE_BLOCK || record.size < sizeof(trace_block_t))
+            continue;
+        c->pos = mData + entry.offset + sizeof(record) + sizeof(trace_block_t);
+        c->end = mData + entry.offset + sizeof(record) + record.size;
+        c->left = record.count;
+        c->time = entry.first;
+        memset(c->prev, 0, sizeof(c->prev));
+        if (decode(c))
+            return true;
+    }
+    return false;
+}
+
+bool TraceReader::decode(Cursor* c)
+{
+    if (!c->left) {
+        c->block++;
+        return startBlock(c);
+    }
+
+    uint64_t dt, key, dv;
+    uint8_t const* p = c->pos;
+    if (!(p = TraceCodec::get(p, c->end, &dt)) ||
+        !(p = TraceCodec::get(p, c->end, &key)) ||
+        !(p = TraceCodec::get(p, c->end, &dv))) {
+        LOGE("corrupted block in the input trace");
+        c->left = 0;
+        c->block++;
+        return startBlock(c);
+    }
+    c->pos = p;
+    c->left--;
+    c->time += TraceCodec::unzigzag(dt);
+    c->type = key & 0x1f;
+    c->code = key >> 5;
+    int32_t& prev = c->prev[TraceCodec::slot(c->type, c->code)];
+    prev += int32_t(TraceCodec::unzigzag(dv));
+    c->value = prev;
+    return true;
+}
+
+bool TraceReader::next(size_t* device, input_event* event)
+{
+    Cursor* c = NULL;
+    for (size_t d=0 ; d<mNumDevices ; d++) {
+        Cursor* const o = &mCursors[d];
+        if (o->pending && (!c || o->time < c->time)) {
+            c = o;
+            *device = d;
+        }
+    }
+    if (!c)
+        return false;
+
+    event->time.tv_sec = c->time / 1000000;
+    event->time.tv_usec = c->time % 1000000;
+    event->type = c->type;
+    event->code = c->code;
+    event->value = c->value;
+    c->pending = decode(c);
+    return true;
+}
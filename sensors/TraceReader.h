@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_TRACE_READER_H
+#define ANDROID_TRACE_READER_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "TraceFormat.h"
+
+/*****************************************************************************/
+
+struct input_event;
+
+/*
+ * Reads an input trace mapped in memory, the events of all the devices
+ * merged in time order. seek() goes through the index to the blocks
+ * covering a time, only those and the one before get decoded.
+ */
+class TraceReader
+{
+public:
+    enum { maxDevices = 16 };
+
+            TraceReader();
+            ~TraceReader();
+
+    int open(const char* path);
+
+    size_t getNumDevices() const { return mNumDevices; }
+    const char* getDeviceName(size_t device) const;
+    int64_t getStartTime() const { return mStart; }     // us
+    int64_t getEndTime() const { return mEnd; }
+
+    // the next events of each device are those of its first frame
+    // starting at or after time, a replay never starts in the middle of one
+    void seek(int64_t time);
+    // returns false at the end of the trace
+    bool next(size_t* device, input_event* event);
+
+private:
+    struct Cursor {
+        trace_index_t* blocks;
+        size_t numBlocks;
+        size_t block;               // the one being decoded
+        uint8_t const* pos;
+        uint8_t const* end;
+        size_t left;
+        int64_t time;               // of the pending event
+        uint16_t type;
+        uint16_t code;
+        int32_t value;
+        bool pending;
+        int32_t prev[TraceCodec::numPredictors];
+    };
+
+    uint8_t const* mData;
+    size_t mSize;
+    char mNames[maxDevices][80];
+    Cursor mCursors[maxDevices];
+    size_t mNumDevices;
+    int64_t mStart;
+    int64_t mEnd;
+
+    int loadIndex(trace_index_t** index, size_t* size);
+    bool startBlock(Cursor* c);
+    bool decode(Cursor* c);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_TRACE_READER_H
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/input.h>
+
+#include <cutils/log.h>
+
+#include "TraceWriter.h"
+
+/*****************************************************************************/
+
+TraceWriter::TraceWriter()
+    : mFile(NULL),
+      mOffset(0),
+      mNumDevices(0),
+      mIndex(NULL),
+      mIndexSize(0),
+      mIndexCapacity(0)
+{
+    memset(mChannels, 0, sizeof(mChannels));
+}
+
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+int TraceWriter::open(const char* path)
+{
+    mFile = fopen(path, "w");
+    if (!mFile)
+        return -errno;
+
+    trace_header_t header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    fwrite(&header, sizeof(header), 1, mFile);
+    mOffset = sizeof(header);
+
+    mIndexCapacity = 256;
+    mIndex = (trace_index_t*)malloc(mIndexCapacity * sizeof(trace_index_t));
+    return 0;
+}
+
+void TraceWriter::close()
+{
+    if (!mFile)
+        return;
+
+    for (size_t i=0 ; i<mNumDevices ; i++) {
+        flush(i);
+        delete mChannels[i];
+        mChannels[i] = NULL;
+    }
+
+    if (mIndex) {
+        trace_trailer_t trailer;
+        trailer.index = mOffset;
+        trailer.magic = TRACE_MAGIC;
+        trace_record_t record;
+        record.kind = TRACE_INDEX;
+        record.device = 0;
+        record.count = 0;
+        record.size = mIndexSize * sizeof(trace_index_t);
+        fwrite(&record, sizeof(record), 1, mFile);
+        fwrite(mIndex, sizeof(trace_index_t), mIndexSize, mFile);
+        fwrite(&trailer, sizeof(trailer), 1, mFile);
+    }
+    fclose(mFile);
+    mFile = NULL;
+
+    free(mIndex);
+    mIndex = NULL;
+    mIndexSize = mIndexCapacity = 0;
+    mNumDevices = 0;
+}
+
+int TraceWriter::addDevice(const char* name)
+{
+    if (!mFile)
+        return -EBADF;
+    if (mNumDevices >= maxDevices)
+        return -ENOSPC;
+
+    Channel* channel = new Channel;
+    channel->size = 0;
+    channel->count = 0;
+    mChannels[mNumDevices] = channel;
+
+    trace_record_t record;
+    record.kind = TRACE_DEVICE;
+    record.device = mNumDevices;
+    record.count = 0;
+    record.size = strlen(name);
+    writeRecord(record, 0, 0);
+    fwrite(name, record.size, 1, mFile);
+    fflush(mFile);
+    return mNumDevices++;
+}
+
+void TraceWriter::write(int device, input_event const* events, size_t count)
+{
+    if (!mFile || device < 0 || size_t(device) >= mNumDevices)
+        return;
+
+    Channel* const c = mChannels[device];
+    for (size_t i=0 ; i<count ; i++) {
+        input_event const& e = events[i];
+        const int64_t time = int64_t(e.time.tv_sec)*1000000LL + e.time.tv_usec;
+        if (c->count && (c->size + TraceCodec::maxEventSize > blockSize ||
+                c->count == 0xffff || time - c->first >= blockSpan)) {
+            flush(device);
+        }
+        if (!c->count) {
+            c->first = c->last = time;
+            memset(c->prev, 0, sizeof(c->prev));
+        }
+
+        int32_t& prev = c->prev[TraceCodec::slot(e.type, e.code)];
+        uint8_t* p = c->data + c->size;
+        p = TraceCodec::put(p, TraceCodec::zigzag(time - c->last));
+        p = TraceCodec::put(p, uint32_t(e.code) << 5 | (e.type & 0x1f));
+        p = TraceCodec::put(p, TraceCodec::zigzag(int64_t(e.value) - prev));
+        prev = e.value;
+        c->size = p - c->data;
+        c->count++;
+        c->last = time;
+    }
+}
+
+void TraceWriter::writeRecord(trace_record_t const& record,
+        int64_t first, int64_t last)
+{
+    if (mIndexSize == mIndexCapacity && mIndex) {
+        const size_t capacity = mIndexCapacity*2;
+        trace_index_t* index = (trace_index_t*)realloc(mIndex,
+                capacity * sizeof(trace_index_t));
+        if (!index) {
+            // the trace goes without, the reader walks the records
+            LOGE("out of memory for the trace index");
+            free(mIndex);
+        }
+        mIndex = index;
+        mIndexCapacity = capacity;
+    }
+    if (mIndex) {
+        trace_index_t& entry = mIndex[mIndexSize++];
+        entry.offset = mOffset;
+        entry.kind = record.kind;
+        entry.device = record.device;
+        entry.count = record.count;
+        entry.first = first;
+        entry.last = last;
+    }
+
+    fwrite(&record, sizeof(record), 1, mFile);
+    mOffset += sizeof(record) + record.size;
+}
+
+void TraceWriter::flush(int device)
+{
+    Channel* const c = mChannels[device];
+    if (!c->count)
+        return;
+
+    trace_block_t block;
+    block.first = c->first;
+    block.last = c->last;
+    trace_record_t record;
+    record.kind = TRACE_BLOCK;
+    record.device = device;
+    record.count = c->count;
+    record.size = sizeof(block) + c->size;
+    writeRecord(record, block.first, block.last);
+    fwrite(&block, sizeof(block), 1, mFile);
+    fwrite(c->data, c->size, 1, mFile);
+    fflush(mFile);
+    c->size = 0;
+    c->count = 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_TRACE_WRITER_H
+#define ANDROID_TRACE_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "TraceFormat.h"
+
+/*****************************************************************************/
+
+struct input_event;
+
+/*
+ * Writes an input trace as the events come, one block per device filled at
+ * a time. A block goes out when it is full or spans more than a second, so
+ * a crash loses little, and the index goes out at close.
+ */
+class TraceWriter
+{
+public:
+    enum { maxDevices = 16 };
+
+            TraceWriter();
+            ~TraceWriter();
+
+    int open(const char* path);
+    void close();
+
+    // returns the id of the device, or -errno
+    int addDevice(const char* name);
+    void write(int device, input_event const* events, size_t count);
+
+private:
+    enum {
+        blockSize       = 4096,         // bytes of events
+        blockSpan       = 1000000,      // us
+    };
+
+    struct Channel {
+        uint8_t data[blockSize];
+        size_t size;
+        size_t count;
+        int64_t first;
+        int64_t last;
+        int32_t prev[TraceCodec::numPredictors];
+    };
+
+    FILE* mFile;
+    uint32_t mOffset;
+    Channel* mChannels[maxDevices];
+    size_t mNumDevices;
+    trace_index_t* mIndex;
+    size_t mIndexSize;
+    size_t mIndexCapacity;
+
+    void writeRecord(trace_record_t const& record, int64_t first, int64_t last);
+    void flush(int device);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_TRACE_WRITER_H
@@ -0,0 +1,908 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host benchmark for the sensors HAL.
+ *
+ * Each driver gets the read end of a pipe instead of its /dev/input node.
+ * One feeder thread per enabled sensor writes input_event frames into the
+ * pipe, stamped with CLOCK_MONOTONIC at write time, while the main thread
+ * drains the HAL through its poll() entry point. For every combination of
+ * enabled sensors and poll() count the benchmark reports throughput, CPU
+ * time per event on the polling thread and the p50/p99 latency between
+ * a frame being written and the HAL returning it.
+ *
+ * The streams are synthetic unless a recorded one is given with
+ * -t <input name>=<file>; the file holds raw struct input_event records
+ * and is replayed in a loop, one EV_SYN terminated frame at a time.
+ *
+ * With -p <file>, a trace recorded by the HAL itself (sensors.trace.mode
+ * set to record, see InputTrace.h) is replayed instead, once per poll()
+ * count. The replay goes through InputTrace and TraceReader like on a
+ * device, with the sensors of the trace that the benchmark knows
+ * enabled. Without -r it goes as fast as the HAL takes it, and the
+ * latencies are only meaningful with -r.
+ *
+ * Before the runs the gyroscope integration of SensorFusion is checked
+ * against the closed form rotation for a constant rate, the input device
+ * index against a fake sysfs tree whose event numbers get reused,
+ * flush() against the events it must come after, and a trace written by
+ * TraceWriter against what TraceReader reads back and seeks to. The
+ * benchmark fails if any check does.
+ *
+ * usage: sensors_bench [-n frames] [-r] [-t name=file]... [-p file]
+ *   -n  frames written per enabled sensor and run (default 20000)
+ *   -r  pace each stream at its sensor rate instead of as fast as possible,
+ *       or a replay at its recorded timing
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <linux/input.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+#include "SensorFusion.h"
+#include "InputDeviceIndex.h"
+#include "InputTrace.h"
+#include "TraceReader.h"
+#include "TraceWriter.h"
+
+extern "C" const struct sensors_module_t HAL_MODULE_INFO_SYM;
+
+/*****************************************************************************/
+
+struct Axis {
+    uint16_t type;
+    uint16_t code;
+};
+
+struct Channel {
+    const char* inputName;
+    int handle;
+    int64_t period;             // ns, used with -r
+    const Axis* axes;
+    size_t numAxes;
+    size_t oversampling;        // frames per event out of the HAL
+
+    input_event* trace;         // one or more EV_SYN terminated frames
+    size_t traceSize;
+
+    int fds[2];
+    size_t frames;
+    bool paced;
+    pthread_t thread;
+};
+
+static const Axis sAccelAxes[] = {
+    { EV_REL, EVENT_TYPE_ACCEL_X },
+    { EV_REL, EVENT_TYPE_ACCEL_Y },
+    { EV_REL, EVENT_TYPE_ACCEL_Z },
+};
+static const Axis sLightAxes[] = {
+    { EV_MSC, EVENT_TYPE_LIGHT },
+};
+static const Axis sCompassAxes[] = {
+    { EV_REL, EVENT_TYPE_MAGV_X },
+    { EV_REL, EVENT_TYPE_MAGV_Y },
+    { EV_REL, EVENT_TYPE_MAGV_Z },
+};
+static const Axis sPressureAxes[] = {
+    { EV_ABS, EVENT_TYPE_PRESSURE },
+};
+static const Axis sGyroAxes[] = {
+    { EV_REL, EVENT_TYPE_GYRO_P },
+    { EV_REL, EVENT_TYPE_GYRO_R },
+    { EV_REL, EVENT_TYPE_GYRO_Y },
+};
+
+enum {
+    accelerometer   = 0,
+    light           = 1,
+    compass         = 2,
+    barometer       = 3,
+    gyroscope       = 4,
+    numChannels
+};
+
+static Channel sChannels[numChannels] = {
+    { "accelerometer", ID_A,  20000000, sAccelAxes,    ARRAY_SIZE(sAccelAxes),    1 },
+    { "max9635_als",   ID_L, 200000000, sLightAxes,    ARRAY_SIZE(sLightAxes),    1 },
+    { "compass",       ID_M,  30000000, sCompassAxes,  ARRAY_SIZE(sCompassAxes),  1 },
+    { "barometer",     ID_B,  30000000, sPressureAxes, ARRAY_SIZE(sPressureAxes),
+            PRESSURE_OVERSAMPLING },
+    { "gyroscope",     ID_G,   1250000, sGyroAxes,     ARRAY_SIZE(sGyroAxes),     1 },
+};
+
+struct Mix {
+    const char* name;
+    uint32_t channels;
+};
+
+static const Mix sMixes[] = {
+    { "accel",              1<<accelerometer },
+    { "gyro",               1<<gyroscope },
+    { "accel+gyro",         (1<<accelerometer) | (1<<gyroscope) },
+    { "accel+gyro+compass", (1<<accelerometer) | (1<<gyroscope) | (1<<compass) },
+    { "all",                (1<<numChannels) - 1 },
+};
+
+static const int sCounts[] = { 1, 4, 16, 64, 256 };
+
+/*****************************************************************************/
+
+static int64_t now(clockid_t clock) {
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+static int compareLatency(const void* a, const void* b) {
+    int64_t l = *(const int64_t*)a;
+    int64_t r = *(const int64_t*)b;
+    return l < r ? -1 : (l > r ? 1 : 0);
+}
+
+static int provideInput(const char* inputName) {
+    for (int i=0 ; i<numChannels ; i++) {
+        if (!strcmp(sChannels[i].inputName, inputName))
+            return sChannels[i].fds[0];
+    }
+    return -1;
+}
+
+static void makeSyntheticTrace(Channel* c) {
+    const size_t numFrames = 64;
+    const size_t frameSize = c->numAxes + 1;
+    c->traceSize = numFrames * frameSize;
+    c->trace = new input_event[c->traceSize];
+    memset(c->trace, 0, c->traceSize * sizeof(input_event));
+
+    input_event* ev = c->trace;
+    for (size_t f=0 ; f<numFrames ; f++) {
+        for (size_t a=0 ; a<c->numAxes ; a++, ev++) {
+            ev->type = c->axes[a].type;
+            ev->code = c->axes[a].code;
+            ev->value = int(f * 7 + a * 131) - 256;
+            if (ev->type == EV_MSC) {
+                // the light sensor only reports changes, make each frame
+                // one
+                ev->value = (f & 1) ? 2000 : 4000;
+            }
+        }
+        ev->type = EV_SYN;
+        ev->code = SYN_REPORT;
+        ev++;
+    }
+}
+
+static int loadTrace(Channel* c, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "can't open %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size / sizeof(input_event);
+    input_event* trace = new input_event[size];
+    ssize_t nread = read(fd, trace, size * sizeof(input_event));
+    close(fd);
+
+    // only keep whole frames
+    while (size && trace[size-1].type != EV_SYN)
+        size--;
+    if (nread < 0 || !size) {
+        fprintf(stderr, "%s has no complete frame\n", path);
+        delete [] trace;
+        return -1;
+    }
+    c->trace = trace;
+    c->traceSize = size;
+    return 0;
+}
+
+static void* feeder(void* arg) {
+    Channel* c = (Channel*)arg;
+    const int64_t start = now(CLOCK_MONOTONIC);
+    size_t pos = 0;
+
+    for (size_t f=0 ; f<c->frames ; f++) {
+        size_t end = pos;
+        while (c->trace[end].type != EV_SYN)
+            end++;
+        end++;
+
+        const int64_t t = now(CLOCK_MONOTONIC);
+        for (size_t i=pos ; i<end ; i++) {
+            c->trace[i].time.tv_sec = t / 1000000000LL;
+            c->trace[i].time.tv_usec = (t % 1000000000LL) / 1000;
+        }
+        const char* p = (const char*)&c->trace[pos];
+        size_t size = (end - pos) * sizeof(input_event);
+        while (size) {
+            ssize_t n = write(c->fds[1], p, size);
+            if (n < 0) {
+                fprintf(stderr, "%s: write failed (%s)\n",
+                        c->inputName, strerror(errno));
+                return 0;
+            }
+            p += n;
+            size -= n;
+        }
+        pos = end < c->traceSize ? end : 0;
+
+        if (c->paced) {
+            const int64_t next = start + int64_t(f + 1) * c->period;
+            struct timespec ts;
+            ts.tv_sec = next / 1000000000LL;
+            ts.tv_nsec = next % 1000000000LL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+        }
+    }
+    return 0;
+}
+
+static void quatMultiply(const float* a, const float* b, float* r) {
+    r[0] = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+    r[1] = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+    r[2] = a[0]*b[2] - a[1]*b[3] + a[2]*b[0] + a[3]*b[1];
+    r[3] = a[0]*b[3] + a[1]*b[2] - a[2]*b[1] + a[3]*b[0];
+}
+
+static int checkFusion() {
+    // the device is tilted so the attitude starts away from identity, then
+    // the accelerometer goes quiet so only the gyroscope moves it
+    const float rate[3] = { 0.3f, -0.2f, 0.5f };
+    const int64_t period = 5000000;
+    const int steps = 200;
+    const float tilt = float(30 * M_PI / 180);
+    const uint32_t enabled = 1<<ID_RV;
+
+    SensorFusion fusion;
+    sensors_event_t event, out[1];
+    memset(&event, 0, sizeof(event));
+    event.sensor = ID_A;
+    event.acceleration.y = GRAVITY_EARTH * sinf(tilt);
+    event.acceleration.z = GRAVITY_EARTH * cosf(tilt);
+    fusion.process(event, out, 1, enabled);
+
+    memset(&event, 0, sizeof(event));
+    event.sensor = ID_G;
+    memcpy(event.gyro.v, rate, sizeof(rate));
+    fusion.process(event, out, 1, enabled);
+
+    sensors_event_t still;
+    memset(&still, 0, sizeof(still));
+    still.sensor = ID_A;
+    fusion.process(still, out, 1, enabled);
+
+    float start[4], q[4];
+    for (int i=1 ; i<=steps ; i++) {
+        event.timestamp = i * period;
+        if (fusion.process(event, out, 1, enabled) != 1) {
+            fprintf(stderr, "fusion check: no rotation vector\n");
+            return -1;
+        }
+        q[0] = out[0].data[3];
+        q[1] = out[0].data[0];
+        q[2] = out[0].data[1];
+        q[3] = out[0].data[2];
+        if (i == 1)
+            memcpy(start, q, sizeof(start));
+    }
+
+    // q(t) = q(0) * (cos(|w|t/2), sin(|w|t/2) w/|w|), w in the device frame
+    const float t = (steps - 1) * period * 1e-9f;
+    const float n = sqrtf(rate[0]*rate[0] + rate[1]*rate[1] + rate[2]*rate[2]);
+    const float s = sinf(0.5f * n * t) / n;
+    const float r[4] = { cosf(0.5f * n * t), rate[0]*s, rate[1]*s, rate[2]*s };
+    float expected[4];
+    quatMultiply(start, r, expected);
+
+    float dot = 0;
+    for (int i=0 ; i<4 ; i++)
+        dot += q[i] * expected[i];
+    if (fabsf(dot) < 0.9999f) {
+        fprintf(stderr, "fusion check: got (%f %f %f %f), expected (%f %f %f %f)\n",
+                q[0], q[1], q[2], q[3],
+                expected[0], expected[1], expected[2], expected[3]);
+        return -1;
+    }
+    return 0;
+}
+
+// gives eventN of the fake tree under dir the named device, or none
+static void plugDevice(const char* dir, int number, const char* name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/sys/event%d", dir, number);
+    mkdir(path, 0700);
+    strcat(path, "/device");
+    mkdir(path, 0700);
+    strcat(path, "/name");
+    if (!name) {
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/dev/event%d", dir, number);
+        unlink(path);
+        return;
+    }
+    FILE* f = fopen(path, "w");
+    fprintf(f, "%s\n", name);
+    fclose(f);
+    // the stub EVIOCGNAME returns the node contents, with the nul
+    snprintf(path, sizeof(path), "%s/dev/event%d", dir, number);
+    f = fopen(path, "w");
+    fwrite(name, strlen(name) + 1, 1, f);
+    fclose(f);
+}
+
+static int checkOpened(const char* name) {
+    int fd = InputDeviceIndex::openDevice(name);
+    char got[80] = "";
+    if (fd >= 0) {
+        read(fd, got, sizeof(got) - 1);
+        close(fd);
+    }
+    if (strcmp(got, name)) {
+        fprintf(stderr, "input index check: opened '%s' for '%s'\n", got, name);
+        return -1;
+    }
+    return 0;
+}
+
+static int checkInputIndex() {
+    char dir[] = "/tmp/sensors_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "input index check: mkdtemp failed (%s)\n",
+                strerror(errno));
+        return -1;
+    }
+    char sysfs[PATH_MAX], dev[PATH_MAX];
+    snprintf(sysfs, sizeof(sysfs), "%s/sys", dir);
+    snprintf(dev, sizeof(dev), "%s/dev", dir);
+    mkdir(sysfs, 0700);
+    mkdir(dev, 0700);
+    InputDeviceIndex::setDirs(sysfs, dev);
+
+    plugDevice(dir, 0, "accelerometer");
+    plugDevice(dir, 1, "compass");
+    int err = checkOpened("compass");
+
+    // the compass comes back as event2 and the gyroscope takes event1,
+    // which the index still has as the compass: looking the gyroscope up
+    // has to read the name of event1 again
+    plugDevice(dir, 1, NULL);
+    plugDevice(dir, 1, "gyroscope");
+    plugDevice(dir, 2, "compass");
+    if (!err)
+        err = checkOpened("gyroscope");
+    if (!err)
+        err = checkOpened("compass");
+    if (!err)
+        err = checkOpened("accelerometer");
+
+    for (int i=0 ; i<3 ; i++) {
+        plugDevice(dir, i, NULL);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/event%d/device", sysfs, i);
+        rmdir(path);
+        snprintf(path, sizeof(path), "%s/event%d", sysfs, i);
+        rmdir(path);
+    }
+    rmdir(sysfs);
+    rmdir(dev);
+    rmdir(dir);
+    InputDeviceIndex::setDirs("/sys/class/input", "/dev/input");
+    return err;
+}
+
+// writes frames of the accelerometer with value on every axis
+static void writeAccelFrames(int fd, int frames, int value) {
+    const Channel* c = &sChannels[accelerometer];
+    input_event frame[ARRAY_SIZE(sAccelAxes) + 1];
+    memset(frame, 0, sizeof(frame));
+    for (int f=0 ; f<frames ; f++) {
+        const int64_t t = now(CLOCK_MONOTONIC);
+        for (size_t i=0 ; i<ARRAY_SIZE(frame) ; i++) {
+            frame[i].time.tv_sec = t / 1000000000LL;
+            frame[i].time.tv_usec = (t % 1000000000LL) / 1000;
+            if (i < c->numAxes) {
+                frame[i].type = c->axes[i].type;
+                frame[i].code = c->axes[i].code;
+                frame[i].value = value;
+            } else {
+                frame[i].type = EV_SYN;
+                frame[i].code = SYN_REPORT;
+            }
+        }
+        write(fd, frame, sizeof(frame));
+    }
+}
+
+static int checkFlushOrder() {
+    // the events written before flush() are small, the ones after large;
+    // they are all batched, so only the flush lets any of them out
+    const int frames = 20;
+    const int small = 100, large = 10000;
+    Channel* const c = &sChannels[accelerometer];
+    for (int i=0 ; i<numChannels ; i++) {
+        sChannels[i].fds[0] = sChannels[i].fds[1] = -1;
+    }
+    if (pipe(c->fds) < 0) {
+        fprintf(stderr, "pipe failed (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    hw_device_t* device;
+    init_nusensors(&HAL_MODULE_INFO_SYM.common, &device);
+    sensors_poll_device_ext_t* dev = (sensors_poll_device_ext_t*)device;
+    dev->base.activate(&dev->base, ID_A, 1);
+    dev->batch(dev, ID_A, 0, 10000000000LL);
+    sensors_event_t buffer[64];
+    dev->base.poll(&dev->base, buffer, 0);
+
+    writeAccelFrames(c->fds[1], frames, small);
+    // the driver threads read the pipe on their own
+    usleep(20000);
+    dev->flush(dev, ID_A);
+    writeAccelFrames(c->fds[1], frames, large);
+
+    // the large events read by the time the marker goes out may come
+    // before it, but all the small ones must
+    int before = 0;
+    float threshold = 0;
+    int err = -1;
+    for (int polls=0 ; err<0 && polls<10 ; polls++) {
+        int n = dev->base.poll(&dev->base, buffer, ARRAY_SIZE(buffer));
+        for (int i=0 ; i<n ; i++) {
+            const float x = fabsf(buffer[i].acceleration.x);
+            if (!threshold)
+                threshold = x * sqrtf(large / small);
+            if (buffer[i].type == SENSOR_TYPE_META_DATA) {
+                if (err < 0)
+                    err = before == frames ? 0 : 1;
+            } else if (x < threshold) {
+                if (err < 0)
+                    before++;
+                else
+                    err = 1;
+            }
+        }
+    }
+    device->close(device);
+    close(c->fds[1]);
+    if (err) {
+        fprintf(stderr, "flush check: %d of %d events before the marker\n",
+                before, frames);
+        return -1;
+    }
+    return 0;
+}
+
+// the events of the trace check: frames of three axes and an EV_SYN, their
+// events 10us apart so that a time can fall in the middle of one
+static void makeTraceFrame(int device, int frame, input_event* events) {
+    const int64_t start = 1000000 + frame * 1000LL + device * 500;
+    for (int i=0 ; i<4 ; i++) {
+        const int64_t t = start + i * 10;
+        events[i].time.tv_sec = t / 1000000;
+        events[i].time.tv_usec = t % 1000000;
+        events[i].type = i < 3 ? EV_REL : EV_SYN;
+        events[i].code = i < 3 ? REL_X + i : SYN_REPORT;
+        events[i].value = i < 3 ? (frame * 37 + i * 1000) * (device ? -1 : 1) : 0;
+    }
+}
+
+static int checkTrace() {
+    // long enough for the blocks to be cut, some of them mid-frame
+    const int frames = 3000;
+    const char* const names[2] = { "accelerometer", "gyroscope" };
+    char path[] = "/tmp/sensors_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "trace check: mkstemp failed (%s)\n", strerror(errno));
+        return -1;
+    }
+    close(fd);
+
+    TraceWriter writer;
+    if (writer.open(path)) {
+        fprintf(stderr, "trace check: can't write %s\n", path);
+        unlink(path);
+        return -1;
+    }
+    writer.addDevice(names[0]);
+    writer.addDevice(names[1]);
+    input_event frame[4];
+    for (int f=0 ; f<frames ; f++) {
+        for (int d=0 ; d<2 ; d++) {
+            makeTraceFrame(d, f, frame);
+            writer.write(d, frame, 4);
+        }
+    }
+    writer.close();
+
+    TraceReader reader;
+    int err = reader.open(path);
+    unlink(path);
+    if (err || reader.getNumDevices() != 2 ||
+            strcmp(reader.getDeviceName(0), names[0]) ||
+            strcmp(reader.getDeviceName(1), names[1])) {
+        fprintf(stderr, "trace check: bad trace header or devices\n");
+        return -1;
+    }
+
+    // everything comes back, in time order
+    size_t device;
+    input_event event;
+    for (int f=0 ; f<frames ; f++) {
+        for (int d=0 ; d<2 ; d++) {
+            makeTraceFrame(d, f, frame);
+            for (int i=0 ; i<4 ; i++) {
+                if (!reader.next(&device, &event) || device != size_t(d) ||
+                        memcmp(&event, &frame[i], sizeof(event))) {
+                    fprintf(stderr, "trace check: event %d of frame %d of "
+                            "device %d differs\n", i, f, d);
+                    return -1;
+                }
+            }
+        }
+    }
+    if (reader.next(&device, &event)) {
+        fprintf(stderr, "trace check: events past the end\n");
+        return -1;
+    }
+
+    // a seek to a frame start, or anywhere in it after its first event,
+    // resumes each device at the start of a frame
+    const int64_t offsets[] = { 0, 5, 10, 25, 30, 31 };
+    for (int f=0 ; f<frames-1 ; f+=97) {
+        for (size_t o=0 ; o<ARRAY_SIZE(offsets) ; o++) {
+            const int64_t time = 1000000 + f * 1000LL + offsets[o];
+            reader.seek(time);
+            bool seen[2] = { false, false };
+            while (!(seen[0] && seen[1]) && reader.next(&device, &event)) {
+                if (seen[device])
+                    continue;
+                seen[device] = true;
+                // the frames of the gyroscope start 500us later
+                const int expected = f + (!device && offsets[o] ? 1 : 0);
+                makeTraceFrame(device, expected, frame);
+                if (memcmp(&event, &frame[0], sizeof(event))) {
+                    fprintf(stderr, "trace check: seek to %lld resumes device "
+                            "%zu at (%d %d) instead of frame %d\n",
+                            (long long)time, device, event.type, event.code,
+                            expected);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int run(const Mix& mix, int count, size_t frames, bool paced) {
+    for (int i=0 ; i<numChannels ; i++) {
+        Channel* c = &sChannels[i];
+        if (pipe(c->fds) < 0) {
+            fprintf(stderr, "pipe failed (%s)\n", strerror(errno));
+            return -1;
+        }
+        c->frames = frames;
+        c->paced = paced;
+    }
+
+    hw_device_t* device;
+    init_nusensors(&HAL_MODULE_INFO_SYM.common, &device);
+    sensors_poll_device_t* dev = (sensors_poll_device_t*)device;
+
+    size_t expected = 0;
+    for (int i=0 ; i<numChannels ; i++) {
+        if (mix.channels & (1<<i)) {
+            dev->activate(dev, sChannels[i].handle, 1);
+            // unpaced runs feed as fast as they can, ask for all of it or
+            // the HAL decimates
+            dev->setDelay(dev, sChannels[i].handle, paced ? sChannels[i].period : 0);
+            expected += frames / sChannels[i].oversampling;
+        }
+    }
+
+    int64_t* latencies = new int64_t[expected];
+    sensors_event_t* buffer = new sensors_event_t[count];
+
+    // the poll thread turns the drivers on, let it do so before feeding
+    // them like the hardware would only sample once enabled
+    dev->poll(dev, buffer, 0);
+
+    for (int i=0 ; i<numChannels ; i++) {
+        if (mix.channels & (1<<i))
+            pthread_create(&sChannels[i].thread, 0, feeder, &sChannels[i]);
+    }
+
+    const int64_t wallStart = now(CLOCK_MONOTONIC);
+    const int64_t cpuStart = now(CLOCK_THREAD_CPUTIME_ID);
+    size_t received = 0;
+    while (received < expected) {
+        int n = dev->poll(dev, buffer, count);
+        if (n < 0) {
+            fprintf(stderr, "poll failed (%s)\n", strerror(-n));
+            break;
+        }
+        const int64_t t = now(CLOCK_MONOTONIC);
+        for (int i=0 ; i<n && received<expected ; i++) {
+            latencies[received++] = t - buffer[i].timestamp;
+        }
+    }
+    const int64_t cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    const int64_t wall = now(CLOCK_MONOTONIC) - wallStart;
+
+    for (int i=0 ; i<numChannels ; i++) {
+        if (mix.channels & (1<<i))
+            pthread_join(sChannels[i].thread, 0);
+    }
+    device->close(device);
+    for (int i=0 ; i<numChannels ; i++) {
+        close(sChannels[i].fds[1]);
+    }
+
+    if (received) {
+        qsort(latencies, received, sizeof(int64_t), compareLatency);
+        printf("%-20s %5d %9zu %12.0f %9.1f %9.1f %9.1f\n",
+                mix.name, count, received,
+                received * 1e9 / wall,
+                double(cpu) / received,
+                latencies[received * 50 / 100] / 1000.0,
+                latencies[received * 99 / 100] / 1000.0);
+    }
+
+    delete [] buffer;
+    delete [] latencies;
+    return 0;
+}
+
+/*
+ * The HAL doesn't tell when a replay is over: once nothing has come out of
+ * it for a while, a flush makes poll() return with a marker that ends the
+ * run.
+ */
+struct ReplayRun {
+    sensors_poll_device_ext_t* dev;
+    int handle;                 // any of those enabled
+    volatile size_t received;
+    volatile bool done;
+};
+
+static void* replayWatchdog(void* arg) {
+    ReplayRun* run = (ReplayRun*)arg;
+    size_t last = size_t(-1);
+    while (!run->done) {
+        usleep(500000);
+        if (run->done)
+            break;
+        if (run->received == last) {
+            run->dev->flush(run->dev, run->handle);
+            break;
+        }
+        last = run->received;
+    }
+    return 0;
+}
+
+// the channels whose input devices are in the trace, and the events the
+// HAL should return for them
+static int scanReplay(const char* path, uint32_t* channels, size_t* expected) {
+    TraceReader reader;
+    int err = reader.open(path);
+    if (err) {
+        fprintf(stderr, "can't read trace %s (%s)\n", path, strerror(-err));
+        return -1;
+    }
+    int channel[TraceReader::maxDevices];
+    size_t frames[numChannels];
+    memset(frames, 0, sizeof(frames));
+    *channels = 0;
+    for (size_t d=0 ; d<reader.getNumDevices() ; d++) {
+        channel[d] = -1;
+        for (int i=0 ; i<numChannels ; i++) {
+            if (!strcmp(sChannels[i].inputName, reader.getDeviceName(d))) {
+                channel[d] = i;
+                *channels |= 1<<i;
+            }
+        }
+    }
+    size_t device;
+    input_event event;
+    while (reader.next(&device, &event)) {
+        if (channel[device] >= 0 && event.type == EV_SYN)
+            frames[channel[device]]++;
+    }
+    *expected = 0;
+    for (int i=0 ; i<numChannels ; i++) {
+        *expected += frames[i] / sChannels[i].oversampling;
+    }
+    if (!*channels) {
+        fprintf(stderr, "%s has no input device the benchmark knows\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int runReplay(const char* path, int count, bool paced) {
+    uint32_t channels;
+    size_t expected;
+    if (scanReplay(path, &channels, &expected))
+        return -1;
+
+    // the replay holds off while the sensors are turned on, the drivers
+    // drop what they read before that
+    const int64_t delay = 100000000;
+    const int64_t wallStart = now(CLOCK_MONOTONIC) + delay;
+    InputTrace::setReplay(path, paced, delay);
+    hw_device_t* device;
+    init_nusensors(&HAL_MODULE_INFO_SYM.common, &device);
+    InputTrace::setReplay(NULL, false, 0);
+    sensors_poll_device_ext_t* dev = (sensors_poll_device_ext_t*)device;
+
+    ReplayRun run;
+    run.dev = dev;
+    run.received = 0;
+    run.done = false;
+    for (int i=0 ; i<numChannels ; i++) {
+        if (channels & (1<<i)) {
+            run.handle = sChannels[i].handle;
+            dev->base.activate(&dev->base, run.handle, 1);
+            dev->base.setDelay(&dev->base, run.handle, 0);
+        }
+    }
+
+    int64_t* latencies = new int64_t[expected + 1];
+    sensors_event_t* buffer = new sensors_event_t[count];
+    dev->base.poll(&dev->base, buffer, 0);
+    pthread_t watchdog;
+    pthread_create(&watchdog, 0, replayWatchdog, &run);
+
+    const int64_t cpuStart = now(CLOCK_THREAD_CPUTIME_ID);
+    int64_t wallEnd = wallStart;
+    bool idle = false;
+    while (!idle && run.received < expected) {
+        int n = dev->base.poll(&dev->base, buffer, count);
+        if (n < 0) {
+            fprintf(stderr, "poll failed (%s)\n", strerror(-n));
+            break;
+        }
+        const int64_t t = now(CLOCK_MONOTONIC);
+        for (int i=0 ; i<n ; i++) {
+            if (buffer[i].type == SENSOR_TYPE_META_DATA) {
+                idle = true;
+            } else if (run.received < expected) {
+                latencies[run.received++] = t - buffer[i].timestamp;
+                wallEnd = t;
+            }
+        }
+    }
+    // the wait for the watchdog isn't part of it
+    const int64_t cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    const int64_t wall = wallEnd - wallStart;
+
+    run.done = true;
+    pthread_join(watchdog, 0);
+    device->close(device);
+
+    const size_t received = run.received;
+    if (received) {
+        qsort(latencies, received, sizeof(int64_t), compareLatency);
+        printf("%-20s %5d %9zu %12.0f %9.1f %9.1f %9.1f\n",
+                "replay", count, received,
+                received * 1e9 / wall,
+                double(cpu) / received,
+                latencies[received * 50 / 100] / 1000.0,
+                latencies[received * 99 / 100] / 1000.0);
+    }
+    if (received < expected) {
+        printf("%-20s %5d %9zu events of %zu lost\n",
+                "", count, expected - received, expected);
+    }
+
+    delete [] buffer;
+    delete [] latencies;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    size_t frames = 20000;
+    bool paced = false;
+    const char* replay = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:rt:p:")) != -1) {
+        switch (opt) {
+            case 'n':
+                frames = strtoul(optarg, 0, 0);
+                break;
+            case 'r':
+                paced = true;
+                break;
+            case 't': {
+                char* file = strchr(optarg, '=');
+                if (!file) {
+                    fprintf(stderr, "-t expects <input name>=<file>\n");
+                    return 1;
+                }
+                *file++ = '\0';
+                int i;
+                for (i=0 ; i<numChannels ; i++) {
+                    if (!strcmp(sChannels[i].inputName, optarg))
+                        break;
+                }
+                if (i == numChannels) {
+                    fprintf(stderr, "unknown input device '%s'\n", optarg);
+                    return 1;
+                }
+                if (loadTrace(&sChannels[i], file))
+                    return 1;
+                break;
+            }
+            case 'p':
+                replay = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n frames] [-r] [-t name=file]... "
+                        "[-p file]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    for (int i=0 ; i<numChannels ; i++) {
+        if (!sChannels[i].trace)
+            makeSyntheticTrace(&sChannels[i]);
+    }
+
+    if (checkFusion() || checkInputIndex() || checkTrace())
+        return 1;
+
+    SensorBase::setInputProvider(provideInput);
+    if (checkFlushOrder())
+        return 1;
+
+    printf("%-20s %5s %9s %12s %9s %9s %9s\n",
+            "sensors", "count", "events", "events/s", "ns/event",
+            "p50(us)", "p99(us)");
+    if (replay) {
+        // the replay stands in for the pipes of the synthetic runs
+        for (size_t c=0 ; c<ARRAY_SIZE(sCounts) ; c++) {
+            if (runReplay(replay, sCounts[c], paced))
+                return 1;
+        }
+        return 0;
+    }
+    for (size_t m=0 ; m<ARRAY_SIZE(sMixes) ; m++) {
+        for (size_t c=0 ; c<ARRAY_SIZE(sCounts) ; c++) {
+            if (run(sMixes[m], sCounts[c], frames, paced))
+                return 1;
+        }
+    }
+    return 0;
+}
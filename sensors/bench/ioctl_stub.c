@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <linux/input.h>
+
+/*
+ * The control nodes (/dev/kxtf9, /dev/l3g4200d, ...) don't exist on the
+ * host, so the drivers end up issuing their ioctls on a dev_fd of -1.
+ * Pretend those succeed so the sensors can be enabled, and pass anything
+ * else through to the kernel.
+ *
+ * The event nodes the input device index is checked against are plain
+ * files holding the device name, EVIOCGNAME returns their contents.
+ */
+int ioctl(int fd, unsigned long request, ...)
+{
+    va_list ap;
+    void* arg;
+    int result;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void*);
+    va_end(ap);
+
+    if (fd < 0)
+        return 0;
+    result = syscall(SYS_ioctl, fd, request, arg);
+    if (result < 0 && errno == ENOTTY &&
+            (request & ~(_IOC_SIZEMASK << _IOC_SIZESHIFT)) == EVIOCGNAME(0)) {
+        result = pread(fd, arg, _IOC_SIZE(request), 0);
+    }
+    return result;
+}
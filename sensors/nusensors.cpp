@@ -22,11 +22,15 @@
 
 #include <poll.h>
 #include <pthread.h>
+#include <time.h>
+
+#include <sys/epoll.h>
 
 #include <linux/input.h>
 
 #include <cutils/atomic.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "nusensors.h"
 #include "AccelerationSensor.h"
@@ -34,17 +38,35 @@
 #include "AkmSensor.h"
 #include "PressureSensor.h"
 #include "GyroSensor.h"
+#include "EventBatcher.h"
+#include "SensorStats.h"
+#include "DriverThread.h"
+#include "SensorFusion.h"
+#include "GyroBias.h"
+#include "ControlChannel.h"
+#include "SensorConfig.h"
+#include "DirectChannel.h"
+#include "InputTrace.h"
+#include "InputDeviceIndex.h"
 
 /*****************************************************************************/
 
 struct sensors_poll_context_t {
-    struct sensors_poll_device_t device; // must be first
+    struct sensors_poll_device_ext_t device; // must be first
 
         sensors_poll_context_t();
         ~sensors_poll_context_t();
     int activate(int handle, int enabled);
     int setDelay(int handle, int64_t ns);
+    int batch(int handle, int64_t period, int64_t timeout);
+    int flush(int handle);
+    int registerDirectChannel(size_t size, int* fd);
+    int unregisterDirectChannel(int channel);
+    int configDirectReport(int channel, int handle, int64_t period);
+    int setSeaLevelPressure(float hPa);
     int pollEvents(sensors_event_t* data, int count);
+    int dump(char* buffer, size_t size);
+    void teardown();
 
 private:
     enum {
@@ -58,17 +80,106 @@ private:
     };
 
     static const size_t wake = numFds - 1;
-    static const char WAKE_MESSAGE = 'W';
-    struct pollfd mPollFds[numFds];
-    int mWritePipeFd;
+    enum { maxDirectChannels = SensorConfig::maxDirectChannels };
+    enum { numProbeThreads = 3 };
+    enum { stageSize = 32 };    // events
+    int mEpollFd;
+    ControlChannel mControl;
+    // what the entry points asked for, and the part of it the poll
+    // thread has set up
+    SensorConfig mConfig;
+    SensorConfig::Snapshot mApplied;
+    int32_t mAppliedSeq;
+    uint32_t mPendingFlushes;   // handles waiting for their flush marker
+    // held while commands run, so that an entry point can run them in
+    // place of the poll thread when no poll() is in flight
+    pthread_mutex_t mControlLock;
+    pthread_cond_t mControlCond;    // the queue has room, or mPolling fell
+    int mPolling;               // poll() calls in flight
+    volatile int32_t mClosing;
+    uint32_t mArmedMask;    // drivers whose data fd is in the epoll set
+    uint32_t mReadyMask;    // drivers with unread data since the last wait
     SensorBase* mSensors[numSensorDrivers];
 
+    // events read from each driver and not returned yet, pollInline()
+    // merges them by timestamp
+    sensors_event_t mStage[numSensorDrivers][stageSize];
+    int mStagePos[numSensorDrivers];
+    int mStageEnd[numSensorDrivers];
+
+    // the drivers are probed in the background, each one is only used
+    // once its bit is set in mProbedMask
+    pthread_t mProbeThreads[numProbeThreads];
+    int mNumProbeThreads;
+    volatile int32_t mNextProbe;
+    volatile int32_t mProbedMask;
+    pthread_mutex_t mLock;      // protects the epoll set and the wait below
+    pthread_cond_t mProbedCond;
+    EventBatcher mBatcher;
+
+    // handles activated by clients, and physical sensors kept on for the
+    // virtual ones, as set up on the poll thread from mConfig
+    uint32_t mClientMask;
+    uint32_t mFusionInputs;
+    SensorFusion mFusion;
+    GyroBias mGyroBias;
+
+    // direct report channels, by channel - 1. Their slots and rates are
+    // in mConfig; the channels themselves belong to the poll thread,
+    // which writes them.
+    uint32_t mDirectMask;
+    DirectChannel* mDirect[maxDirectChannels];
+
+    // period each handle was set to, and when its next event is due;
+    // drivers run at the fastest rate any consumer needs and the others
+    // are decimated here
+    int64_t mPeriods[NUM_SENSOR_HANDLES];
+    int64_t mNextEvent[NUM_SENSOR_HANDLES];
+
+    // with ro.sensors.threaded set, each driver is read on its own thread
+    bool mThreaded;
+    DriverThread* mThreads[numSensorDrivers];
+    volatile int32_t mConsumerSleeping;
+
+    static void* probeThread(void* arg);
+    void probeDrivers();
+    bool isProbed(int index) const;
+    SensorBase* waitForDriver(int index);
+    SensorBase* suspendDriver(int index);
+    void resumeDriver(int index);
+    void updateWaitSet(int index);
+    void updateWaitSetLocked(int index);
+    int enableSensor(int handle, int enabled);
+    int updateActive(uint32_t clients, uint32_t direct);
+    int applyDelay(int handle);
+    void applyConfig();
+    bool isDue(int handle, int64_t timestamp);
+    int processEvents(sensors_event_t* data, int nb, int count);
+    void doSetDelay(int handle, int64_t ns);
+    bool handleCommands();
+    bool handleCommandsLocked();
+    int postLocked(int what, int handle, int64_t timeout);
+    int flushPending(sensors_event_t* data, int count);
+    bool isDrained() const;
+    bool fillStage(int index);
+    int mergeStages(sensors_event_t* data, int count);
+    int pollInline(sensors_event_t* data, int count);
+    int pollThreaded(sensors_event_t* data, int count);
+
+    static bool isOnChange(int handle) {
+        return handle == ID_L || handle == ID_P;
+    }
+
+    static bool isVirtual(int handle) {
+        return handle == ID_O || handle == ID_RV ||
+                handle == ID_GR || handle == ID_LA || handle == ID_AL;
+    }
+
     int handleToDriver(int handle) const {
         switch (handle) {
             case ID_A:
                 return acceleration;
             case ID_M:
-            case ID_O:
                 return akm;
             case ID_G:
                 return gyro;
@@ -84,115 +195,821 @@ private:
 /*****************************************************************************/
 
 sensors_poll_context_t::sensors_poll_context_t()
+    : mAppliedSeq(-1),
+      mPendingFlushes(0),
+      mPolling(0),
+      mClosing(0),
+      mArmedMask(0),
+      mReadyMask(0),
+      mNumProbeThreads(0),
+      mNextProbe(0),
+      mProbedMask(0),
+      mClientMask(0),
+      mFusionInputs(0),
+      mDirectMask(0),
+      mThreaded(false),
+      mConsumerSleeping(0)
 {
-    mSensors[acceleration] = new AccelerationSensor();
-    mPollFds[acceleration].fd = mSensors[acceleration]->getFd();
-    mPollFds[acceleration].events = POLLIN;
-    mPollFds[acceleration].revents = 0;
-
-    mSensors[light] = new LightSensor();
-    mPollFds[light].fd = mSensors[light]->getFd();
-    mPollFds[light].events = POLLIN;
-    mPollFds[light].revents = 0;
-
-    mSensors[akm] = new AkmSensor();
-    mPollFds[akm].fd = mSensors[akm]->getFd();
-    mPollFds[akm].events = POLLIN;
-    mPollFds[akm].revents = 0;
-
-    mSensors[pressure] = new PressureSensor();
-    mPollFds[pressure].fd = mSensors[pressure]->getFd();
-    mPollFds[pressure].events = POLLIN;
-    mPollFds[pressure].revents = 0;
-
-    mSensors[gyro] = new GyroSensor();
-    mPollFds[gyro].fd = mSensors[gyro]->getFd();
-    mPollFds[gyro].events = POLLIN;
-    mPollFds[gyro].revents = 0;
-
-    int wakeFds[2];
-    int result = pipe(wakeFds);
-    LOGE_IF(result<0, "error creating wake pipe (%s)", strerror(errno));
-    fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
-    fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
-    mWritePipeFd = wakeFds[1];
-
-    mPollFds[wake].fd = wakeFds[0];
-    mPollFds[wake].events = POLLIN;
-    mPollFds[wake].revents = 0;
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+        mPeriods[i] = 200000000; // 200 ms by default
+        mNextEvent[i] = 0;
+    }
+    mConfig.read(&mApplied, &mAppliedSeq);
+    for (int i=0 ; i<maxDirectChannels ; i++) {
+        mDirect[i] = NULL;
+    }
+
+    mEpollFd = epoll_create(numFds);
+    LOGE_IF(mEpollFd<0, "error creating epoll fd (%s)", strerror(errno));
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = wake;
+    int result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mControl.getFd(), &ev);
+    LOGE_IF(result<0, "error adding control fd to epoll set (%s)", strerror(errno));
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.sensors.threaded", value, "0");
+    mThreaded = atoi(value) != 0;
+
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        mSensors[i] = NULL;
+        mThreads[i] = NULL;
+        mStagePos[i] = mStageEnd[i] = 0;
+    }
+
+    // before the drivers open their input devices
+    InputTrace::start();
+    InputDeviceIndex::refresh();
+
+    // opening the devices and reading their state takes a few ioctls per
+    // driver, don't make the HAL open wait for all of them
+    pthread_mutex_init(&mControlLock, NULL);
+    pthread_cond_init(&mControlCond, NULL);
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mProbedCond, NULL);
+    for (int i=0 ; i<numProbeThreads ; i++) {
+        if (!pthread_create(&mProbeThreads[mNumProbeThreads], NULL,
+                probeThread, this)) {
+            mNumProbeThreads++;
+        }
+    }
+    if (!mNumProbeThreads) {
+        LOGE("couldn't start the probe threads, probing in line");
+        probeDrivers();
+    }
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
+    for (int i=0 ; i<mNumProbeThreads ; i++) {
+        pthread_join(mProbeThreads[i], NULL);
+    }
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        delete mThreads[i];
+        mThreads[i] = NULL;
+    }
+    // pick up the channels whose registration nobody polled for, while
+    // the drivers the other commands reach are still there
+    handleCommands();
     for (int i=0 ; i<numSensorDrivers ; i++) {
         delete mSensors[i];
     }
-    close(mPollFds[wake].fd);
-    close(mWritePipeFd);
+    InputTrace::stop();
+    for (int i=0 ; i<maxDirectChannels ; i++) {
+        delete mDirect[i];
+    }
+    close(mEpollFd);
+    pthread_cond_destroy(&mProbedCond);
+    pthread_mutex_destroy(&mLock);
+    pthread_cond_destroy(&mControlCond);
+    pthread_mutex_destroy(&mControlLock);
 }
 
-int sensors_poll_context_t::activate(int handle, int enabled) {
+void* sensors_poll_context_t::probeThread(void* arg) {
+    sensors_poll_context_t* ctx = (sensors_poll_context_t*)arg;
+    ctx->probeDrivers();
+    return NULL;
+}
+
+void sensors_poll_context_t::probeDrivers() {
+    int index;
+    while ((index = android_atomic_inc(&mNextProbe)) < numSensorDrivers) {
+        SensorBase* sensor = NULL;
+        switch (index) {
+            case acceleration:  sensor = new AccelerationSensor();  break;
+            case light:         sensor = new LightSensor();         break;
+            case akm:           sensor = new AkmSensor();           break;
+            case pressure:      sensor = new PressureSensor();      break;
+            case gyro:          sensor = new GyroSensor();          break;
+        }
+        mSensors[index] = sensor;
+
+        if (mThreaded) {
+            DriverThread* thread = new DriverThread(sensor, mControl.getFd(),
+                    &mConsumerSleeping);
+            if (thread->start()) {
+                delete thread;
+                thread = NULL;
+            }
+            mThreads[index] = thread;
+        }
+
+        // a driver that is already enabled is waited on right away, the
+        // others are added by activate()
+        pthread_mutex_lock(&mLock);
+        updateWaitSetLocked(index);
+        android_atomic_or(1<<index, &mProbedMask);
+        pthread_cond_broadcast(&mProbedCond);
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+bool sensors_poll_context_t::isProbed(int index) const {
+    return android_atomic_acquire_load(&mProbedMask) & (1<<index);
+}
+
+SensorBase* sensors_poll_context_t::waitForDriver(int index) {
+    if (!isProbed(index)) {
+        pthread_mutex_lock(&mLock);
+        while (!isProbed(index)) {
+            pthread_cond_wait(&mProbedCond, &mLock);
+        }
+        pthread_mutex_unlock(&mLock);
+    }
+    return mSensors[index];
+}
+
+SensorBase* sensors_poll_context_t::suspendDriver(int index) {
+    // in threaded mode the driver is being read on its own thread, keep
+    // that one out while the driver is reconfigured
+    SensorBase* sensor = waitForDriver(index);
+    if (mThreads[index])
+        mThreads[index]->suspend();
+    return sensor;
+}
+
+void sensors_poll_context_t::resumeDriver(int index) {
+    if (mThreads[index])
+        mThreads[index]->resume();
+}
+
+void sensors_poll_context_t::teardown() {
+    // new poll() calls return right away, the one in flight is woken up
+    // by the command and we wait for it to leave before going away
+    android_atomic_or(1, &mClosing);
+    pthread_mutex_lock(&mControlLock);
+    postLocked(ControlChannel::CMD_CLOSE, 0, -1);
+    while (mPolling) {
+        pthread_cond_wait(&mControlCond, &mControlLock);
+    }
+    pthread_mutex_unlock(&mControlLock);
+}
+
+/*
+ * Posts a command from an entry point. When the queue is full this waits
+ * for the poll thread to empty it, or empties it here if no poll() is in
+ * flight to do it. A negative timeout waits for as long as it takes.
+ */
+int sensors_poll_context_t::postLocked(int what, int handle, int64_t timeout) {
+    struct timespec deadline;
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        timeout += deadline.tv_nsec;
+        deadline.tv_sec += timeout / 1000000000;
+        deadline.tv_nsec = timeout % 1000000000;
+    }
+    int err;
+    while ((err = mControl.post(what, handle)) == -EAGAIN) {
+        if (!mPolling) {
+            handleCommandsLocked();
+        } else if (timeout < 0) {
+            pthread_cond_wait(&mControlCond, &mControlLock);
+        } else if (pthread_cond_timedwait(&mControlCond, &mControlLock,
+                &deadline) == ETIMEDOUT) {
+            return -ETIMEDOUT;
+        }
+    }
+    return err;
+}
+
+bool sensors_poll_context_t::handleCommands() {
+    pthread_mutex_lock(&mControlLock);
+    const bool closing = handleCommandsLocked();
+    pthread_cond_broadcast(&mControlCond);
+    pthread_mutex_unlock(&mControlLock);
+    return closing;
+}
+
+bool sensors_poll_context_t::handleCommandsLocked() {
+    mControl.drain();
+    bool closing = false;
+    ControlChannel::Command cmd;
+    while (mControl.next(&cmd)) {
+        switch (cmd.what) {
+            case ControlChannel::CMD_FLUSH:
+                mPendingFlushes |= 1<<cmd.handle;
+                // what the kernel holds came before the flush too, read
+                // it out of turn
+                mReadyMask |= mArmedMask;
+                break;
+            case ControlChannel::CMD_CLOSE:
+                closing = true;
+                break;
+            case ControlChannel::CMD_DIRECT_ADD: {
+                const int index = cmd.handle - 1;
+                delete mDirect[index];
+                mDirect[index] = (DirectChannel*)intptr_t(cmd.arg);
+                // the rates the slot had may be asked for again before
+                // the next read, the new channel needs them all the same
+                for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+                    if (mApplied.directRates[index][i] >= 0) {
+                        mApplied.directRates[index][i] = -2;
+                        mAppliedSeq = -1;
+                    }
+                }
+                break;
+            }
+            case ControlChannel::CMD_DIRECT_REMOVE:
+                delete mDirect[cmd.handle - 1];
+                mDirect[cmd.handle - 1] = NULL;
+                break;
+            case ControlChannel::CMD_SEA_LEVEL:
+                mFusion.setSeaLevelPressure(cmd.arg / 1000.0f);
+                break;
+        }
+    }
+    applyConfig();
+    return closing;
+}
+
+void sensors_poll_context_t::applyConfig() {
+    SensorConfig::Snapshot config;
+    if (!mConfig.read(&config, &mAppliedSeq))
+        return;
+
+    int err = updateActive(config.clients, config.direct);
+    LOGE_IF(err, "error turning sensors on or off (%s)", strerror(-err));
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+        const uint32_t m = 1<<i;
+        if (config.latencies[i] != mApplied.latencies[i]) {
+            mBatcher.setLatency(i, config.latencies[i]);
+        }
+        if ((mApplied.clients & m) && !(config.clients & m)) {
+            mBatcher.clear(i);
+        }
+        // the rates a handle needs change with its period and with who
+        // reads it
+        const uint32_t readers = (config.clients ^ mApplied.clients) |
+                (config.direct ^ mApplied.direct);
+        bool changed = (readers & m) || config.periods[i] != mApplied.periods[i];
+        for (int j=0 ; j<maxDirectChannels ; j++) {
+            const int64_t rate = config.directRates[j][i];
+            if (rate != mApplied.directRates[j][i]) {
+                if (mDirect[j]) {
+                    mDirect[j]->setRate(i, rate);
+                }
+                changed = true;
+            }
+        }
+        if (changed) {
+            doSetDelay(i, config.periods[i]);
+        }
+    }
+    mApplied = config;
+}
+
+bool sensors_poll_context_t::isDrained() const {
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (!isProbed(i))
+            continue;
+        if (mThreaded ? (mThreads[i] && mThreads[i]->peek()) :
+                (mStagePos[i] != mStageEnd[i] || (mReadyMask & (1<<i))))
+            return false;
+    }
+    return true;
+}
+
+int sensors_poll_context_t::flushPending(sensors_event_t* data, int count) {
+    // only called once the drivers are drained: everything held back goes
+    // first, the markers once it's all out
+    int nb = mBatcher.flush(data, count);
+    for (int i=0 ; nb<count && mPendingFlushes && i<NUM_SENSOR_HANDLES ; i++) {
+        if (mPendingFlushes & (1<<i)) {
+            mPendingFlushes &= ~(1<<i);
+            sensors_event_t* ev = &data[nb++];
+            memset(ev, 0, sizeof(*ev));
+            ev->version = sizeof(sensors_event_t);
+            ev->sensor = i;
+            ev->type = SENSOR_TYPE_META_DATA;
+            ev->timestamp = EventBatcher::now();
+        }
+    }
+    return nb;
+}
+
+void sensors_poll_context_t::updateWaitSet(int index) {
+    pthread_mutex_lock(&mLock);
+    updateWaitSetLocked(index);
+    pthread_mutex_unlock(&mLock);
+}
+
+void sensors_poll_context_t::updateWaitSetLocked(int index) {
+    if (mThreaded)
+        return;
+
+    SensorBase* const sensor(mSensors[index]);
+    const uint32_t mask = 1<<index;
+    const int fd = sensor->getFd();
+    const bool wanted = fd >= 0 && sensor->isEnabled();
+    if (wanted == !!(mArmedMask & mask))
+        return;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = index;
+    int result = epoll_ctl(mEpollFd,
+            wanted ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &ev);
+    if (result < 0) {
+        LOGE("error updating epoll set for driver %d (%s)",
+                index, strerror(errno));
+        return;
+    }
+    if (wanted) {
+        mArmedMask |= mask;
+    } else {
+        mArmedMask &= ~mask;
+    }
+}
+
+int sensors_poll_context_t::enableSensor(int handle, int enabled) {
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    int err =  mSensors[index]->enable(handle, enabled);
-    if (!err && handle == ID_O) {
-        err = static_cast<AccelerationSensor*>(
-                mSensors[acceleration])->enableOrientation(enabled);
+    int err = suspendDriver(index)->enable(handle, enabled);
+    resumeDriver(index);
+    updateWaitSet(index);
+    return err;
+}
+
+int sensors_poll_context_t::updateActive(uint32_t clients, uint32_t direct) {
+    // a physical sensor is on while a client or a direct channel wants it,
+    // or while a virtual sensor needs it
+    const uint32_t inputs = SensorFusion::inputsOf(clients | direct);
+    const uint32_t wanted = clients | direct | inputs;
+    const uint32_t current = mClientMask | mDirectMask | mFusionInputs;
+    int err = 0;
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+        const uint32_t m = 1<<i;
+        if (!isVirtual(i) && handleToDriver(i) >= 0 &&
+                (wanted & m) != (current & m)) {
+            int result = enableSensor(i, wanted & m);
+            if (!err)
+                err = result;
+        }
+    }
+
+    if (!mFusionInputs && inputs) {
+        mFusion.reset();
     }
-    if (enabled && !err) {
-        const char wakeMessage(WAKE_MESSAGE);
-        int result = write(mWritePipeFd, &wakeMessage, 1);
-        LOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
+    if ((wanted & (1<<ID_G)) && !(current & (1<<ID_G))) {
+        mGyroBias.reset();
+    }
+    mClientMask = clients;
+    mDirectMask = direct;
+    mFusionInputs = inputs;
+    return err;
+}
+
+int sensors_poll_context_t::activate(int handle, int enabled) {
+    if (!isVirtual(handle) && handleToDriver(handle) < 0)
+        return -EINVAL;
+
+    // the poll thread turns the drivers on or off and programs the rates
+    // the handle needs now, errors only make it to the log
+    mConfig.activate(handle, enabled);
+    mControl.wake();
+    return 0;
+}
+
+int sensors_poll_context_t::applyDelay(int handle) {
+    // a virtual sensor asks for its period on each of its inputs
+    const uint32_t reads = isVirtual(handle) ?
+            SensorFusion::inputsOf(1<<handle) : (1<<handle);
+    int64_t ns = (mClientMask & (1<<handle)) ? mPeriods[handle] : -1;
+    for (int i=0 ; i<maxDirectChannels ; i++) {
+        const int64_t rate = mDirect[i] ? mDirect[i]->getRate(handle) : -1;
+        if (rate >= 0 && (ns < 0 || rate < ns)) {
+            ns = rate;
+        }
+    }
+    int err = 0;
+    for (int i=0 ; i<NUM_SENSOR_HANDLES ; i++) {
+        int index = (reads & (1<<i)) ? handleToDriver(i) : -1;
+        if (index >= 0) {
+            int result = suspendDriver(index)->setDelay(handle, ns);
+            resumeDriver(index);
+            if (!err)
+                err = result;
+        }
     }
     return err;
 }
 
 int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
+    if (!isVirtual(handle) && handleToDriver(handle) < 0)
+        return -EINVAL;
+    if (ns < 0)
+        return -EINVAL;
+    mConfig.setPeriod(handle, ns);
+    mControl.wake();
+    return 0;
+}
 
-    int index = handleToDriver(handle);
-    if (index < 0) return index;
-    return mSensors[index]->setDelay(handle, ns);
+void sensors_poll_context_t::doSetDelay(int handle, int64_t ns) {
+    // a negative period reapplies the current one
+    if (ns >= 0) {
+        mPeriods[handle] = ns;
+    }
+    mNextEvent[handle] = 0;
+    applyDelay(handle);
+}
+
+int sensors_poll_context_t::flush(int handle) {
+    if (uint32_t(handle) >= NUM_SENSOR_HANDLES || !mConfig.isActivated(handle))
+        return -EINVAL;
+    return mControl.post(ControlChannel::CMD_FLUSH, handle);
+}
+
+int sensors_poll_context_t::registerDirectChannel(size_t size, int* fd) {
+    const int index = mConfig.addDirectChannel();
+    if (index < 0)
+        return index;
+
+    DirectChannel* channel = new DirectChannel(size);
+    int err = channel->initCheck();
+    if (!err) {
+        *fd = dup(channel->getFd());
+        err = *fd < 0 ? -errno : 0;
+    }
+    if (!err) {
+        err = mControl.post(ControlChannel::CMD_DIRECT_ADD,
+                index + 1, intptr_t(channel));
+        if (err) {
+            close(*fd);
+        }
+    }
+    if (err) {
+        delete channel;
+        mConfig.releaseDirectChannel(index);
+        return err;
+    }
+    return index + 1;
+}
+
+int sensors_poll_context_t::unregisterDirectChannel(int channel) {
+    // the rates go first, the slot is only given out again once the
+    // removal is queued ahead of whatever is added to it next
+    int err = mConfig.removeDirectChannel(channel - 1);
+    if (err)
+        return err;
+    pthread_mutex_lock(&mControlLock);
+    err = postLocked(ControlChannel::CMD_DIRECT_REMOVE, channel,
+            1000000000);    // 1 s
+    if (!err && !mPolling) {
+        // nobody is going to read it, take the channel down now
+        handleCommandsLocked();
+    }
+    pthread_mutex_unlock(&mControlLock);
+    if (err) {
+        // the slot stays taken, a channel might still be in it
+        LOGE("couldn't remove direct channel %d (%s)", channel, strerror(-err));
+        return err;
+    }
+    mConfig.releaseDirectChannel(channel - 1);
+    return 0;
+}
+
+int sensors_poll_context_t::configDirectReport(int channel, int handle, int64_t period) {
+    if (!isVirtual(handle) && handleToDriver(handle) < 0)
+        return -EINVAL;
+    int err = mConfig.setDirectRate(channel - 1, handle, period);
+    if (err)
+        return err;
+    mControl.wake();
+    return 0;
+}
+
+int sensors_poll_context_t::setSeaLevelPressure(float hPa) {
+    if (!(hPa > 0))
+        return -EINVAL;
+    return mControl.post(ControlChannel::CMD_SEA_LEVEL, 0,
+            int64_t(hPa * 1000.0f + 0.5f));
+}
+
+bool sensors_poll_context_t::isDue(int handle, int64_t timestamp) {
+    if (uint32_t(handle) >= NUM_SENSOR_HANDLES || isOnChange(handle))
+        return true;
+    return isDueOnGrid(timestamp, mPeriods[handle], &mNextEvent[handle]);
+}
+
+int sensors_poll_context_t::batch(int handle, int64_t period, int64_t timeout) {
+    if (!isVirtual(handle) && handleToDriver(handle) < 0)
+        return -EINVAL;
+    if (period < 0 || timeout < 0)
+        return -EINVAL;
+    mConfig.setLatency(handle, timeout);
+    return setDelay(handle, period);
+}
+
+int sensors_poll_context_t::processEvents(sensors_event_t* data, int nb, int count) {
+    // take the gyroscope offset out before anything uses the rates, the
+    // accelerometer tells it when the device is still
+    for (int i=0 ; i<nb ; i++) {
+        if (data[i].sensor == ID_G) {
+            mGyroBias.correct(&data[i]);
+        } else if (data[i].sensor == ID_A) {
+            mGyroBias.addAccel(data[i]);
+        }
+    }
+
+    // the virtual sensor events go right after the ones they derive from
+    int total = nb;
+    if (mFusionInputs) {
+        const uint32_t virtuals = (mClientMask | mDirectMask) &
+                ((1<<ID_O) | (1<<ID_RV) | (1<<ID_GR) | (1<<ID_LA) | (1<<ID_AL));
+        for (int i=0 ; i<nb && total<count ; i++) {
+            total += mFusion.process(data[i], data + total, count - total, virtuals);
+        }
+    }
+
+    // the direct channels get everything, at their own rates
+    for (int i=0 ; mDirectMask && i<maxDirectChannels ; i++) {
+        if (mDirect[i]) {
+            for (int j=0 ; j<total ; j++) {
+                mDirect[i]->report(data[j]);
+            }
+        }
+    }
+
+    // hide the sensors that are only on for the fusion or the direct
+    // channels, and decimate the handles that run faster than their
+    // clients asked for
+    const uint32_t hidden = (mFusionInputs | mDirectMask) & ~mClientMask;
+    int kept = 0;
+    for (int i=0 ; i<total ; i++) {
+        const int handle = data[i].sensor;
+        if (uint32_t(handle) < 32 && (hidden & (1<<handle)))
+            continue;
+        if (!isDue(handle, data[i].timestamp))
+            continue;
+        if (kept != i) {
+            data[kept] = data[i];
+        }
+        kept++;
+    }
+    total = kept;
+
+    // events of batched sensors are held back
+    return mBatcher.filter(data, total);
+}
+
+int sensors_poll_context_t::dump(char* buffer, size_t size) {
+    return SensorStats::dump(buffer, size);
+}
+
+int sensors_poll_context_t::pollThreaded(sensors_event_t* data, int count)
+{
+    int nbEvents = 0;
+
+    for (;;) {
+        // the rates must be in place before the events they apply to go
+        // through, and the queues may not be empty for a while
+        if ((mControl.hasCommands() || mConfig.hasChanged(mAppliedSeq)) &&
+                handleCommands())
+            break;
+
+        if (count && mBatcher.isFlushDue(EventBatcher::now())) {
+            int nb = mBatcher.flush(data, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+
+        // merge the driver queues in timestamp order
+        while (count) {
+            if (!mBatcher.space()) {
+                // a ring is full, it goes out before it takes more
+                int nb = mBatcher.flush(data, count);
+                count -= nb;
+                nbEvents += nb;
+                data += nb;
+                continue;
+            }
+            DriverThread* oldest = NULL;
+            sensors_event_t const* oldestEvent = NULL;
+            for (int i=0 ; i<numSensorDrivers ; i++) {
+                sensors_event_t const* event = (isProbed(i) && mThreads[i]) ?
+                        mThreads[i]->peek() : NULL;
+                if (event && (!oldestEvent ||
+                        event->timestamp < oldestEvent->timestamp)) {
+                    oldest = mThreads[i];
+                    oldestEvent = event;
+                }
+            }
+            if (!oldest)
+                break;
+            *data = *oldestEvent;
+            oldest->pop();
+            int nb = processEvents(data, 1, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+
+        // the flush markers go behind everything queued before them
+        if (count && mPendingFlushes && isDrained()) {
+            int nb = flushPending(data, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+        if (nbEvents || !count)
+            break;
+
+        // nothing to return, tell the driver threads to wake us up and
+        // check the queues one last time before going to sleep
+        android_atomic_or(1, &mConsumerSleeping);
+        bool empty = true;
+        for (int i=0 ; i<numSensorDrivers ; i++) {
+            if (isProbed(i) && mThreads[i] && mThreads[i]->peek()) {
+                empty = false;
+            }
+        }
+        int n = 0;
+        if (empty) {
+            struct epoll_event events[numFds];
+            n = epoll_wait(mEpollFd, events, numFds,
+                    mBatcher.flushTimeout(EventBatcher::now()));
+        }
+        android_atomic_and(0, &mConsumerSleeping);
+        if (n<0) {
+            LOGE("epoll_wait() failed (%s)", strerror(errno));
+            return -errno;
+        }
+        if (n && handleCommands()) {
+            break;
+        }
+    }
+
+    return nbEvents;
 }
 
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
+{
+    pthread_mutex_lock(&mControlLock);
+    mPolling++;
+    pthread_mutex_unlock(&mControlLock);
+    int nb = -ENODEV;
+    if (!android_atomic_acquire_load(&mClosing)) {
+        nb = mThreaded ? pollThreaded(data, count) : pollInline(data, count);
+        if (nb > 0) {
+            SensorStats::eventsDelivered(data, nb);
+        }
+    }
+    pthread_mutex_lock(&mControlLock);
+    mPolling--;
+    pthread_cond_broadcast(&mControlCond);
+    pthread_mutex_unlock(&mControlLock);
+    return nb;
+}
+
+bool sensors_poll_context_t::fillStage(int index) {
+    SensorBase* const sensor(mSensors[index]);
+    const uint32_t mask = 1<<index;
+    if (!(mReadyMask & mask) && !sensor->hasPendingEvents())
+        return false;
+    int nb = sensor->readEvents(mStage[index], stageSize);
+    if (nb < stageSize) {
+        // no more data for this sensor
+        mReadyMask &= ~mask;
+    }
+    mStagePos[index] = 0;
+    mStageEnd[index] = nb > 0 ? nb : 0;
+    return nb > 0;
+}
+
+int sensors_poll_context_t::mergeStages(sensors_event_t* data, int count) {
+    // oldest first across the drivers, so that an event only ever waits
+    // behind older ones however small count is. A driver is read again
+    // as soon as its stage runs out, before anything newer than what it
+    // may still hold goes out.
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (mStagePos[i] != mStageEnd[i] && !mSensors[i]->isEnabled()) {
+            // read before the driver was turned off, stale by now
+            mStagePos[i] = mStageEnd[i] = 0;
+        }
+    }
+    int nb = 0;
+    while (nb < count) {
+        int oldest = -1;
+        int64_t oldestTime = 0;
+        for (int i=0 ; i<numSensorDrivers ; i++) {
+            if (mStagePos[i] == mStageEnd[i] && !(isProbed(i) && fillStage(i)))
+                continue;
+            const int64_t time = mStage[i][mStagePos[i]].timestamp;
+            if (oldest < 0 || time < oldestTime) {
+                oldest = i;
+                oldestTime = time;
+            }
+        }
+        if (oldest < 0)
+            break;
+        data[nb++] = mStage[oldest][mStagePos[oldest]++];
+    }
+    return nb;
+}
+
+int sensors_poll_context_t::pollInline(sensors_event_t* data, int count)
 {
     int nbEvents = 0;
     int n = 0;
+    bool closing = false;
 
     do {
-        // see if we have some leftover from the last poll()
-        for (int i=0 ; count && i<numSensorDrivers ; i++) {
-            SensorBase* const sensor(mSensors[i]);
-            if ((mPollFds[i].revents & POLLIN) || (sensor->hasPendingEvents())) {
-                int nb = sensor->readEvents(data, count);
-                if (nb < count) {
-                    // no more data for this sensor
-                    mPollFds[i].revents = 0;
-                }
+        // apply what was posted since the last wait before reading on
+        if ((mControl.hasCommands() || mConfig.hasChanged(mAppliedSeq)) &&
+                handleCommands())
+            break;
+
+        // deliver the batched events once one of them is due
+        if (count && mBatcher.isFlushDue(EventBatcher::now())) {
+            int nb = mBatcher.flush(data, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+
+        // see if we have some leftover from the last wait
+        while (count) {
+            // leave room for the virtual sensors derived from each event,
+            // and don't give a batch ring more than it can hold: a full one
+            // goes out before it takes more
+            int room = mFusionInputs ? (count + 3) / 4 : count;
+            const int space = mBatcher.space();
+            if (!space) {
+                int nb = mBatcher.flush(data, count);
                 count -= nb;
                 nbEvents += nb;
                 data += nb;
+                continue;
             }
+            if (room > space)
+                room = space;
+            int nb = mergeStages(data, room);
+            if (!nb)
+                break;
+            nb = processEvents(data, nb, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+
+        // the flush markers go behind everything read before them, once
+        // the stages are empty
+        if (count && mPendingFlushes && isDrained()) {
+            int nb = flushPending(data, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
         }
 
         if (count) {
             // we still have some room, so try to see if we can get
             // some events immediately or just wait if we don't have
-            // anything to return
-            n = poll(mPollFds, numFds, nbEvents ? 0 : -1);
+            // anything to return, or until the next batch is due
+            int timeout = -1;
+            if (nbEvents || mReadyMask) {
+                timeout = 0;
+            } else {
+                timeout = mBatcher.flushTimeout(EventBatcher::now());
+            }
+            struct epoll_event events[numFds];
+            n = epoll_wait(mEpollFd, events, numFds, timeout);
             if (n<0) {
-                LOGE("poll() failed (%s)", strerror(errno));
+                LOGE("epoll_wait() failed (%s)", strerror(errno));
                 return -errno;
             }
-            if (mPollFds[wake].revents & POLLIN) {
-                char msg;
-                int result = read(mPollFds[wake].fd, &msg, 1);
-                LOGE_IF(result<0, "error reading from wake pipe (%s)", strerror(errno));
-                LOGE_IF(msg != WAKE_MESSAGE, "unknown message on wake queue (0x%02x)", int(msg));
-                mPollFds[wake].revents = 0;
+            for (int i=0 ; i<n ; i++) {
+                const uint32_t token = events[i].data.u32;
+                if (token == wake) {
+                    closing = handleCommands();
+                } else if (events[i].events & EPOLLIN) {
+                    mReadyMask |= 1<<token;
+                }
             }
         }
         // if we have events and space, go read them
-    } while (n && count);
+    } while (count && !closing && (n || mReadyMask || mPendingFlushes ||
+            (!nbEvents && mBatcher.isFlushDue(EventBatcher::now()))));
 
     return nbEvents;
 }
@@ -203,6 +1020,7 @@ static int poll__close(struct hw_device_t *dev)
 {
     sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
     if (ctx) {
+        ctx->teardown();
         delete ctx;
     }
     return 0;
@@ -220,6 +1038,47 @@ static int poll__setDelay(struct sensors_poll_device_t *dev,
     return ctx->setDelay(handle, ns);
 }
 
+static int poll__batch(struct sensors_poll_device_ext_t *dev,
+        int handle, int64_t period_ns, int64_t timeout_ns) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->batch(handle, period_ns, timeout_ns);
+}
+
+static int poll__dump(struct sensors_poll_device_ext_t *dev,
+        char* buffer, size_t size) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->dump(buffer, size);
+}
+
+static int poll__flush(struct sensors_poll_device_ext_t *dev, int handle) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->flush(handle);
+}
+
+static int poll__register_direct_channel(struct sensors_poll_device_ext_t *dev,
+        size_t size, int* fd) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->registerDirectChannel(size, fd);
+}
+
+static int poll__unregister_direct_channel(struct sensors_poll_device_ext_t *dev,
+        int channel) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->unregisterDirectChannel(channel);
+}
+
+static int poll__config_direct_report(struct sensors_poll_device_ext_t *dev,
+        int channel, int handle, int64_t period_ns) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->configDirectReport(channel, handle, period_ns);
+}
+
+static int poll__set_sea_level_pressure(struct sensors_poll_device_ext_t *dev,
+        float hPa) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->setSeaLevelPressure(hPa);
+}
+
 static int poll__poll(struct sensors_poll_device_t *dev,
         sensors_event_t* data, int count) {
     sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
@@ -233,17 +1092,24 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device)
     int status = -EINVAL;
 
     sensors_poll_context_t *dev = new sensors_poll_context_t();
-    memset(&dev->device, 0, sizeof(sensors_poll_device_t));
+    memset(&dev->device, 0, sizeof(sensors_poll_device_ext_t));
 
-    dev->device.common.tag = HARDWARE_DEVICE_TAG;
-    dev->device.common.version  = 0;
-    dev->device.common.module   = const_cast<hw_module_t*>(module);
-    dev->device.common.close    = poll__close;
-    dev->device.activate        = poll__activate;
-    dev->device.setDelay        = poll__setDelay;
-    dev->device.poll            = poll__poll;
+    dev->device.base.common.tag = HARDWARE_DEVICE_TAG;
+    dev->device.base.common.version  = 0;
+    dev->device.base.common.module   = const_cast<hw_module_t*>(module);
+    dev->device.base.common.close    = poll__close;
+    dev->device.base.activate        = poll__activate;
+    dev->device.base.setDelay        = poll__setDelay;
+    dev->device.base.poll            = poll__poll;
+    dev->device.batch                = poll__batch;
+    dev->device.dump                 = poll__dump;
+    dev->device.flush                = poll__flush;
+    dev->device.register_direct_channel = poll__register_direct_channel;
+    dev->device.unregister_direct_channel = poll__unregister_direct_channel;
+    dev->device.config_direct_report = poll__config_direct_report;
+    dev->device.set_sea_level_pressure = poll__set_sea_level_pressure;
 
-    *device = &dev->device.common;
+    *device = &dev->device.base.common;
     status = 0;
     return status;
 }
@@ -34,6 +34,103 @@ __BEGIN_DECLS
 
 int init_nusensors(hw_module_t const* module, hw_device_t** device);
 
+/*
+ * Stingray extensions to the poll device. The hw_device_t returned by the
+ * module's open() is the start of this structure, so clients that know
+ * about it can cast it back to reach the extra entry points.
+ */
+struct sensors_poll_device_ext_t {
+    struct sensors_poll_device_t base;
+
+    /*
+     * Samples the sensor every period_ns and lets its events be held back
+     * for up to timeout_ns before they are returned by poll(). A timeout
+     * of 0 returns to delivering each event as soon as it is read.
+     */
+    int (*batch)(struct sensors_poll_device_ext_t *dev,
+            int handle, int64_t period_ns, int64_t timeout_ns);
+
+    /*
+     * Writes the per-sensor event counters and latency histograms to
+     * buffer, returns the length written. poll() stores the time each
+     * event left the HAL (CLOCK_MONOTONIC, ns) in reserved1[0] (low word)
+     * and reserved1[1] (high word).
+     */
+    int (*dump)(struct sensors_poll_device_ext_t *dev,
+            char* buffer, size_t size);
+
+    /*
+     * Delivers the events held back for the sensor, followed by an event
+     * of type SENSOR_TYPE_META_DATA whose sensor is the flushed handle.
+     * Returns -EINVAL if the sensor isn't active.
+     */
+    int (*flush)(struct sensors_poll_device_ext_t *dev, int handle);
+
+    /*
+     * Creates a direct report channel: a shared memory ring of size bytes
+     * (see direct_report_header_t) that the HAL writes the events of the
+     * sensors configured on it into, without going through poll(). The
+     * caller owns the fd returned in *fd and hands it to the consumers,
+     * which map it read-only. Returns the channel (> 0).
+     */
+    int (*register_direct_channel)(struct sensors_poll_device_ext_t *dev,
+            size_t size, int* fd);
+    int (*unregister_direct_channel)(struct sensors_poll_device_ext_t *dev,
+            int channel);
+
+    /*
+     * Starts reporting the sensor on the channel every period_ns, or stops
+     * it when period_ns is negative. Each channel has its own rate, the
+     * sensor runs at the fastest one anybody needs.
+     */
+    int (*config_direct_report)(struct sensors_poll_device_ext_t *dev,
+            int channel, int handle, int64_t period_ns);
+
+    /*
+     * Sets the pressure at sea level, in hPa, the altitude sensor is
+     * computed against. PRESSURE_SEA_LEVEL until set.
+     */
+    int (*set_sea_level_pressure)(struct sensors_poll_device_ext_t *dev,
+            float hPa);
+};
+
+/*
+ * Layout of a direct report channel. The header is followed by capacity
+ * records; the event at position p (counted from 0, modulo 2^32) is in
+ * record p % capacity, and head is the position of the next one to be
+ * written.
+ *
+ * The HAL is the only writer. It sets the seq of the record to 2p+1, then
+ * writes the event and sets seq to 2p+2, then head to p+1. A reader keeps
+ * its own position: it reads head (a position more than capacity behind
+ * it has been overwritten), and for each record it reads seq, copies the
+ * event and reads seq again. The copy is good if both reads gave 2p+2;
+ * anything past that means the writer lapped the reader.
+ */
+#define DIRECT_REPORT_MAGIC     (0x53524444)    // 'DDRS'
+#define DIRECT_REPORT_VERSION   (1)
+
+struct direct_report_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;          // records
+    uint32_t recordSize;        // bytes
+    volatile int32_t head;
+    uint32_t reserved[11];      // pads the header to 64 bytes
+};
+
+struct direct_report_record_t {
+    volatile int32_t seq;
+    int32_t reserved;
+    sensors_event_t event;
+};
+
+// marks the end of a flush(), same value as later HAL versions
+#define SENSOR_TYPE_META_DATA       (0)
+
+// altitude above sea level in data[0], in meters
+#define SENSOR_TYPE_ALTITUDE        (0x10001)
+
 /*****************************************************************************/
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
@@ -47,6 +144,14 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 #define ID_B  (6)
 #define ID_G  (7)
 
+// virtual sensors computed by SensorFusion
+#define ID_RV (8)
+#define ID_GR (9)
+#define ID_LA (10)
+#define ID_AL (11)
+
+#define NUM_SENSOR_HANDLES  (ID_AL + 1)
+
 /*****************************************************************************/
 
 /*
@@ -65,6 +170,25 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 #define BAROMETER_DEVICE_NAME       "/dev/bmp085"
 #define GYROSCOPE_DEVICE_NAME       "/dev/l3g4200d"
 
+// default file of InputTrace, see sensors.trace.file
+#define INPUT_TRACE_FILE            "/data/misc/sensors/input.trace"
+
+// where the magnetometer calibration is kept across restarts
+#define MAG_CALIBRATION_FILE        "/data/system/sensors_magnetometer.cal"
+
+// evdev puts this in a client's queue when it overflowed, the events up
+// to the next SYN_REPORT are to be thrown away. Kernels before 2.6.39
+// don't, they silently lose the oldest events.
+#ifndef SYN_DROPPED
+#define SYN_DROPPED                 3
+#endif
+
+// the input readers grow to hold this long of a sensor's output at the
+// rate it is programmed, so that one read drains what piled up in evdev
+// while the poll loop was busy
+#define INPUT_READER_SPAN           (40000000LL)    // ns
+#define INPUT_READER_MAX_EVENTS     (512)
+
 #define EVENT_TYPE_ACCEL_X          REL_X
 #define EVENT_TYPE_ACCEL_Y          REL_Y
 #define EVENT_TYPE_ACCEL_Z          REL_Z
@@ -114,6 +238,22 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 
 #define CONVERT_B                   (1.0f/100.0f)
 
+// the barometer runs this many times faster than asked and the samples
+// are averaged, then smoothed with an IIR filter of this coefficient
+// (1 is no smoothing); ro.sensors.pressure.oversampling and
+// ro.sensors.pressure.smoothing override them
+#define PRESSURE_OVERSAMPLING       (4)
+#define PRESSURE_SMOOTHING          (0.5f)
+#define PRESSURE_SEA_LEVEL          (1013.25f)
+
+// calibration of the light sensor, "<index> <lux>" per line
+#define LIGHT_CALIBRATION_FILE      "/system/etc/max9635_lux.conf"
+
+// a light change has to be larger than both of these to be reported,
+// they can be overridden with ro.sensors.light.relative and ro.sensors.light.absolute
+#define LIGHT_HYSTERESIS_RELATIVE   (0.10f)
+#define LIGHT_HYSTERESIS_ABSOLUTE   (1.0f)
+
 #define SENSOR_STATE_MASK           (0x7FFF)
 
 /*****************************************************************************/
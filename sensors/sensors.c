@@ -45,11 +45,27 @@ static const struct sensor_t sSensorList[] = {
 	{ "BMP085 Pressure sensor",
                 "Bosch",
                 1, SENSORS_HANDLE_BASE+ID_B,
-                SENSOR_TYPE_PRESSURE, 110000.0f, 1.0f, 1.0f, 30000, { } },
+                SENSOR_TYPE_PRESSURE, 110000.0f, 1.0f, 1.0f, 30000*PRESSURE_OVERSAMPLING, { } },
 	{ "L3G4200D Gyroscope sensor",
                 "ST Micro",
                 1, SENSORS_HANDLE_BASE+ID_G,
                 SENSOR_TYPE_GYROSCOPE, MAX_RANGE_G, CONVERT_G, 6.1f, 1250, { } },
+	{ "Rotation Vector sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_RV,
+                SENSOR_TYPE_ROTATION_VECTOR, 1.0f, 1.0f / (1<<24), 0.57f + 6.8f + 6.1f, 1250, { } },
+	{ "Gravity sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_GR,
+                SENSOR_TYPE_GRAVITY, GRAVITY_EARTH, CONVERT_A, 0.57f + 6.1f, 1250, { } },
+	{ "Linear Acceleration sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_LA,
+                SENSOR_TYPE_LINEAR_ACCELERATION, MAX_RANGE_A, CONVERT_A, 0.57f + 6.1f, 1250, { } },
+	{ "Barometric Altitude sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_AL,
+                SENSOR_TYPE_ALTITUDE, 10000.0f, 0.1f, 1.0f, 30000*PRESSURE_OVERSAMPLING, { } },
 };
 
 static int open_sensors(const struct hw_module_t* module, const char* name,